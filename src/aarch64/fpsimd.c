@@ -0,0 +1,90 @@
+#include <aarch64/fpsimd.h>
+#include <aarch64/intrinsic.h>
+#include <common/string.h>
+#include <kernel/cpu.h>
+#include <kernel/mem.h>
+#include <kernel/proc.h>
+#include <kernel/printk.h>
+#include <kernel/sched.h>
+
+// The fp/simd registers are switched lazily. A process starts with fp/simd
+// trapped at EL0 and gets its state loaded on its first fp/simd instruction.
+// The registers of a cpu stay valid for their owner until another process
+// on that cpu touches fp/simd, so switching back to the owner needs no reload.
+// The kernel is built with -mgeneral-regs-only and never touches them.
+
+// the process whose state is live in the registers of each cpu
+static struct proc* fpsimd_owner[NCPU];
+
+static ALWAYS_INLINE void _fpsimd_set_access(bool enable) {
+    u64 cpacr;
+    asm volatile("mrs %[x], cpacr_el1" : [x] "=r"(cpacr));
+    // FPEN = 0b11: no trap, 0b01: trap EL0 only
+    cpacr = (cpacr & ~(3ull << 20)) | ((enable ? 3ull : 1ull) << 20);
+    asm volatile("msr cpacr_el1, %[x]" : : [x] "r"(cpacr));
+    arch_isb();
+}
+
+static ALWAYS_INLINE bool _fpsimd_enabled() {
+    u64 cpacr;
+    asm volatile("mrs %[x], cpacr_el1" : [x] "=r"(cpacr));
+    return ((cpacr >> 20) & 3) == 3;
+}
+
+void fpsimd_trap()
+{
+    auto p = thisproc();
+    int cpu = cpuid();
+    if (!p->fpsimd) {
+        p->fpsimd = kalloc(sizeof(struct fpsimd_state));
+        if (!p->fpsimd) {
+            printk("No memory for fpsimd state of %d\n", p->pid);
+            p->killed = true;
+            return;
+        }
+        memset(p->fpsimd, 0, sizeof(struct fpsimd_state));
+    }
+    // the owner has saved its state when it was switched out
+    fpsimd_load(p->fpsimd);
+    fpsimd_owner[cpu] = p;
+    p->fpsimd_cpu = cpu;
+    _fpsimd_set_access(true);
+}
+
+void fpsimd_switch(struct proc* prev, struct proc* next)
+{
+    int cpu = cpuid();
+    // prev may have changed the registers if it could access them
+    if (fpsimd_owner[cpu] == prev && _fpsimd_enabled())
+        fpsimd_save(prev->fpsimd);
+    // the registers still hold the state of next if nobody loaded since
+    _fpsimd_set_access(fpsimd_owner[cpu] == next && next->fpsimd_cpu == cpu);
+}
+
+void fpsimd_release()
+{
+    auto p = thisproc();
+    int cpu = cpuid();
+    if (fpsimd_owner[cpu] == p)
+        fpsimd_owner[cpu] = NULL;
+    p->fpsimd_cpu = -1;
+    if (p->fpsimd) {
+        kfree(p->fpsimd);
+        p->fpsimd = NULL;
+    }
+    _fpsimd_set_access(false);
+}
+
+int fpsimd_fork(struct proc* child)
+{
+    auto p = thisproc();
+    if (!p->fpsimd)
+        return 0;
+    child->fpsimd = kalloc(sizeof(struct fpsimd_state));
+    if (!child->fpsimd)
+        return -1;
+    if (fpsimd_owner[cpuid()] == p && _fpsimd_enabled())
+        fpsimd_save(p->fpsimd);
+    memcpy(child->fpsimd, p->fpsimd, sizeof(struct fpsimd_state));
+    return 0;
+}
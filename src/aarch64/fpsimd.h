@@ -0,0 +1,24 @@
+#pragma once
+
+#include <common/defines.h>
+
+struct proc;
+
+// q0-q31, fpsr and fpcr of a process, allocated on its first use of fp/simd
+struct fpsimd_state {
+    u64 vregs[64];
+    u32 fpsr, fpcr;
+};
+
+// defined in fpsimd.S
+void fpsimd_save(struct fpsimd_state* st);
+void fpsimd_load(struct fpsimd_state* st);
+
+// handle the trap of the first fp/simd instruction of the current process
+void fpsimd_trap();
+// called by the scheduler before switching from prev to next
+void fpsimd_switch(struct proc* prev, struct proc* next);
+// give up the fp/simd state of the current process, e.g. on exec/exit
+void fpsimd_release();
+// copy the fp/simd state of the current process to a forked child
+int fpsimd_fork(struct proc* child);
@@ -104,11 +104,33 @@ static ALWAYS_INLINE void arch_tlbi_vmalle1is() {
     arch_fence();
 }
 
-// set Translation Table Base Register 0 (EL1).
+// flush TLB entries of this cpu.
+static ALWAYS_INLINE void arch_tlbi_vmalle1() {
+    arch_fence();
+    asm volatile("tlbi vmalle1");
+    arch_fence();
+}
+
+// flush TLB entries of user address `va` tagged with `asid`.
+static ALWAYS_INLINE void arch_tlbi_vae1is(u64 asid, u64 va) {
+    arch_fence();
+    asm volatile("tlbi vae1is, %[x]" : : [x] "r"((asid << 48) | ((va >> 12) & 0xfffffffffffull)));
+    arch_fence();
+}
+
+// flush TLB entries tagged with `asid`.
+static ALWAYS_INLINE void arch_tlbi_aside1is(u64 asid) {
+    arch_fence();
+    asm volatile("tlbi aside1is, %[x]" : : [x] "r"(asid << 48));
+    arch_fence();
+}
+
+// set Translation Table Base Register 0 (EL1), ASID in bits [63:48].
+// user mappings are tagged with the ASID, so the TLB is not flushed.
 static ALWAYS_INLINE void arch_set_ttbr0(u64 addr) {
     arch_fence();
     asm volatile("msr ttbr0_el1, %[x]" : : [x] "r"(addr));
-    arch_tlbi_vmalle1is();
+    arch_isb();
 }
 // get
 static inline WARN_RESULT u64 arch_get_ttbr0() {
@@ -32,12 +32,25 @@
 #define PTE_RO (1 << 7)
 #define PTE_RW (0 << 7)
 
+/* not global: tagged with the ASID of the address space */
+#define PTE_NG (1 << 11)
+
 #define PTE_KERNEL_DATA   (PTE_KERNEL | PTE_NORMAL | PTE_BLOCK)
 #define PTE_KERNEL_DEVICE (PTE_KERNEL | PTE_DEVICE | PTE_BLOCK)
-#define PTE_USER_DATA     (PTE_USER | PTE_NORMAL | PTE_PAGE)
+#define PTE_USER_DATA     (PTE_USER | PTE_NORMAL | PTE_PAGE | PTE_NG)
 
 #define N_PTE_PER_TABLE 512
 
+/* 2 MB blocks, mapped by a level 2 entry */
+#define HUGE_PAGE_SIZE  (PAGE_SIZE * N_PTE_PER_TABLE)
+#define HUGE_PAGE_ORDER 9
+#define HUGE_BASE(addr) ((u64)(addr) & ~(HUGE_PAGE_SIZE - 1))
+#define PTE_USER_BLOCK  (PTE_USER | PTE_NORMAL | PTE_BLOCK | PTE_NG)
+#define IS_BLOCK_PTE(pte) (((pte) & 0x3) == PTE_BLOCK)
+
+/* table entries: nothing the table maps is writable (APTable[1]) */
+#define PTE_TABLE_RO (1ull << 62)
+
 #define PTE_HIGH_NX (1LL << 54)
 
 #define KSPACE_MASK 0xffff000000000000
@@ -6,6 +6,7 @@
 #include <kernel/proc.h>
 #include <kernel/syscall.h>
 #include <kernel/paging.h>
+#include <aarch64/fpsimd.h>
 
 
 void trap_global_handler(UserContext* context)
@@ -31,6 +32,10 @@ void trap_global_handler(UserContext* context)
             else
                 interrupt_global_handler();
         } break;
+        case ESR_EC_FPSIMD:
+        {
+            fpsimd_trap();
+        } break;
         case ESR_EC_SVC64:
         {
             syscall_entry(context);
@@ -139,6 +139,8 @@ static int pipeline_send(msg_queue* msgq, msg_msg* msg) {
                 rcver->r_msg = NULL;
                 activate_proc(rcver->proc);
             } else {
+                // not a sync wakeup, msgsnd returns to user space and the
+                // sender keeps running
                 rcver->r_msg = msg;
                 activate_proc(rcver->proc);
                 return 1;
@@ -22,6 +22,18 @@ static inline void rb_set_parent(rb_node rb, rb_node p) {
 static inline void rb_set_parent_color(rb_node rb, rb_node p, int color) {
     rb->__rb_parent_color = (unsigned long)p | color;
 }
+static inline void augment_propagate(const struct rb_augment* aug, rb_node node, rb_node stop) {
+    if (aug)
+        aug->propagate(node, stop);
+}
+static inline void augment_copy(const struct rb_augment* aug, rb_node old, rb_node new) {
+    if (aug)
+        aug->copy(old, new);
+}
+static inline void augment_rotate(const struct rb_augment* aug, rb_node old, rb_node new) {
+    if (aug)
+        aug->rotate(old, new);
+}
 static inline void __rb_change_child(rb_node old, rb_node new, rb_node parent, rb_root root) {
     if (parent) {
         if (parent->rb_left == old)
@@ -37,7 +49,7 @@ static inline void __rb_rotate_set_parents(rb_node old, rb_node new, rb_root roo
     rb_set_parent_color(old, new, color);
     __rb_change_child(old, new, parent, root);
 }
-static void __rb_insert_fix(rb_node node, rb_root root) {
+static void __rb_insert_fix(rb_node node, rb_root root, const struct rb_augment* aug) {
     rb_node parent = rb_red_parent(node), gparent, tmp;
     while (1) {
         if (!parent) {
@@ -66,6 +78,7 @@ static void __rb_insert_fix(rb_node node, rb_root root) {
                     rb_set_parent_color(tmp, parent, RB_BLACK);
                 node->rb_left = parent;
                 rb_set_parent_color(parent, node, RB_RED);
+                augment_rotate(aug, parent, node);
                 parent = node;
                 tmp = node->rb_right;
             }
@@ -75,6 +88,7 @@ static void __rb_insert_fix(rb_node node, rb_root root) {
                 rb_set_parent_color(tmp, gparent, RB_BLACK);
             parent->rb_right = gparent;
             __rb_rotate_set_parents(gparent, parent, root, RB_RED);
+            augment_rotate(aug, gparent, parent);
             break;
         } else {
             tmp = gparent->rb_left;
@@ -94,6 +108,7 @@ static void __rb_insert_fix(rb_node node, rb_root root) {
                     rb_set_parent_color(tmp, parent, RB_BLACK);
                 node->rb_right = parent;
                 rb_set_parent_color(parent, node, RB_RED);
+                augment_rotate(aug, parent, node);
                 parent = node;
                 tmp = node->rb_left;
             }
@@ -103,11 +118,12 @@ static void __rb_insert_fix(rb_node node, rb_root root) {
                 rb_set_parent_color(tmp, gparent, RB_BLACK);
             parent->rb_left = gparent;
             __rb_rotate_set_parents(gparent, parent, root, RB_RED);
+            augment_rotate(aug, gparent, parent);
             break;
         }
     }
 }
-static rb_node __rb_erase(rb_node node, rb_root root) {
+static rb_node __rb_erase(rb_node node, rb_root root, const struct rb_augment* aug) {
     rb_node child = node->rb_right, tmp = node->rb_left;
     rb_node parent, rebalance;
     unsigned long pc;
@@ -120,17 +136,20 @@ static rb_node __rb_erase(rb_node node, rb_root root) {
             rebalance = NULL;
         } else
             rebalance = __rb_is_black(pc) ? parent : NULL;
+        tmp = parent;
     } else if (!child) {
         tmp->__rb_parent_color = pc = node->__rb_parent_color;
         parent = __rb_parent(pc);
         __rb_change_child(node, tmp, parent, root);
         rebalance = NULL;
+        tmp = parent;
     } else {
         rb_node successor = child, child2;
         tmp = child->rb_left;
         if (!tmp) {
             parent = successor;
             child2 = successor->rb_right;
+            augment_copy(aug, node, successor);
         } else {
             do {
                 parent = successor;
@@ -140,6 +159,8 @@ static rb_node __rb_erase(rb_node node, rb_root root) {
             parent->rb_left = child2 = successor->rb_right;
             successor->rb_right = child;
             rb_set_parent(child, successor);
+            augment_copy(aug, node, successor);
+            augment_propagate(aug, parent, successor);
         }
         successor->rb_left = tmp = node->rb_left;
         rb_set_parent(tmp, successor);
@@ -155,10 +176,12 @@ static rb_node __rb_erase(rb_node node, rb_root root) {
             successor->__rb_parent_color = pc;
             rebalance = __rb_is_black(pc2) ? parent : NULL;
         }
+        tmp = successor;
     }
+    augment_propagate(aug, tmp, NULL);
     return rebalance;
 }
-static void __rb_erase_fix(rb_node parent, rb_root root) {
+static void __rb_erase_fix(rb_node parent, rb_root root, const struct rb_augment* aug) {
     rb_node node = NULL, sibling, tmp1, tmp2;
     while (1) {
         sibling = parent->rb_right;
@@ -168,6 +191,7 @@ static void __rb_erase_fix(rb_node parent, rb_root root) {
                 rb_set_parent_color(tmp1, parent, RB_BLACK);
                 sibling->rb_left = parent;
                 __rb_rotate_set_parents(parent, sibling, root, RB_RED);
+                augment_rotate(aug, parent, sibling);
                 sibling = tmp1;
             }
             tmp1 = sibling->rb_right;
@@ -190,6 +214,7 @@ static void __rb_erase_fix(rb_node parent, rb_root root) {
                         rb_set_parent_color(tmp1, sibling, RB_BLACK);
                     tmp2->rb_right = sibling;
                     parent->rb_right = tmp2;
+                    augment_rotate(aug, sibling, tmp2);
                     tmp1 = sibling;
                     sibling = tmp2;
                 }
@@ -200,6 +225,7 @@ static void __rb_erase_fix(rb_node parent, rb_root root) {
             sibling->rb_left = parent;
             rb_set_parent_color(tmp1, sibling, RB_BLACK);
             __rb_rotate_set_parents(parent, sibling, root, RB_BLACK);
+            augment_rotate(aug, parent, sibling);
             break;
         } else {
             sibling = parent->rb_left;
@@ -208,6 +234,7 @@ static void __rb_erase_fix(rb_node parent, rb_root root) {
                 rb_set_parent_color(tmp1, parent, RB_BLACK);
                 sibling->rb_right = parent;
                 __rb_rotate_set_parents(parent, sibling, root, RB_RED);
+                augment_rotate(aug, parent, sibling);
                 sibling = tmp1;
             }
             tmp1 = sibling->rb_left;
@@ -230,6 +257,7 @@ static void __rb_erase_fix(rb_node parent, rb_root root) {
                         rb_set_parent_color(tmp1, sibling, RB_BLACK);
                     tmp2->rb_left = sibling;
                     parent->rb_left = tmp2;
+                    augment_rotate(aug, sibling, tmp2);
                     tmp1 = sibling;
                     sibling = tmp2;
                 }
@@ -240,11 +268,13 @@ static void __rb_erase_fix(rb_node parent, rb_root root) {
             sibling->rb_right = parent;
             rb_set_parent_color(tmp1, sibling, RB_BLACK);
             __rb_rotate_set_parents(parent, sibling, root, RB_BLACK);
+            augment_rotate(aug, parent, sibling);
             break;
         }
     }
 }
-int _rb_insert(rb_node node, rb_root rt, bool (*cmp)(rb_node lnode, rb_node rnode)) {
+static int __rb_insert(rb_node node, rb_root rt, bool (*cmp)(rb_node lnode, rb_node rnode),
+                       const struct rb_augment* aug) {
     rb_node nw = rt->rb_node, parent = NULL;
     node->rb_left = node->rb_right = NULL;
     node->__rb_parent_color = 0;
@@ -265,14 +295,40 @@ int _rb_insert(rb_node node, rb_root rt, bool (*cmp)(rb_node lnode, rb_node rnod
         } else
             return -1;
     }
-    __rb_insert_fix(node, rt);
+    augment_propagate(aug, node, NULL);
+    __rb_insert_fix(node, rt, aug);
     return 0;
 }
-void _rb_erase(rb_node node, rb_root root) {
+static void __rb_erase_augmented(rb_node node, rb_root root, const struct rb_augment* aug) {
     rb_node rebalance;
-    rebalance = __rb_erase(node, root);
+    rebalance = __rb_erase(node, root, aug);
     if (rebalance)
-        __rb_erase_fix(rebalance, root);
+        __rb_erase_fix(rebalance, root, aug);
+}
+int _rb_insert(rb_node node, rb_root rt, bool (*cmp)(rb_node lnode, rb_node rnode)) {
+    return __rb_insert(node, rt, cmp, NULL);
+}
+void _rb_erase(rb_node node, rb_root root) {
+    __rb_erase_augmented(node, root, NULL);
+}
+int _rb_insert_augmented(rb_node node, rb_root rt, bool (*cmp)(rb_node lnode, rb_node rnode),
+                         const struct rb_augment* aug) {
+    return __rb_insert(node, rt, cmp, aug);
+}
+void _rb_erase_augmented(rb_node node, rb_root root, const struct rb_augment* aug) {
+    __rb_erase_augmented(node, root, aug);
+}
+rb_node _rb_next(rb_node node) {
+    rb_node parent;
+    if (node->rb_right) {
+        node = node->rb_right;
+        while (node->rb_left)
+            node = node->rb_left;
+        return node;
+    }
+    while ((parent = rb_parent(node)) && node == parent->rb_right)
+        node = parent;
+    return parent;
 }
 rb_node _rb_lookup(rb_node node, rb_root rt, bool (*cmp)(rb_node lnode, rb_node rnode)) {
     rb_node nw = rt->rb_node;
@@ -11,9 +11,23 @@ struct rb_root_ {
     rb_node rb_node;
 };
 typedef struct rb_root_ *rb_root;
+#define _rb_parent(r) ((rb_node)((r)->__rb_parent_color & ~3))
+/* Augmented trees keep a value in each node computed from its subtree.
+   propagate: recompute the values from node up to, not including, stop.
+   copy: new takes the place of old in the tree.
+   rotate: new takes the place of old, and old becomes a child of new. */
+struct rb_augment {
+    void (*propagate)(rb_node node, rb_node stop);
+    void (*copy)(rb_node old, rb_node new);
+    void (*rotate)(rb_node old, rb_node new);
+};
 /* NOTE:You should add lock when use */
 WARN_RESULT int _rb_insert(rb_node node,rb_root root,bool (*cmp)(rb_node lnode,rb_node rnode));
 void _rb_erase(rb_node node, rb_root root);
 rb_node _rb_lookup(rb_node node,rb_root rt,bool (*cmp)(rb_node lnode,rb_node rnode));
 rb_node _rb_first(rb_root root);
+rb_node _rb_next(rb_node node);
+WARN_RESULT int _rb_insert_augmented(rb_node node, rb_root root, bool (*cmp)(rb_node lnode, rb_node rnode),
+                                     const struct rb_augment *aug);
+void _rb_erase_augmented(rb_node node, rb_root root, const struct rb_augment *aug);
 #endif
\ No newline at end of file
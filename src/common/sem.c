@@ -2,6 +2,14 @@
 #include <kernel/mem.h>
 #include <kernel/sched.h>
 #include <kernel/printk.h>
+#include <kernel/init.h>
+
+static struct kmem_cache* wait_cache;
+
+define_early_init(wait_cache)
+{
+    wait_cache = kmem_cache_create("waitdata", sizeof(WaitData), NULL);
+}
 
 void init_sem(Semaphore* sem, int val)
 {
@@ -50,6 +58,17 @@ int post_all_sem(Semaphore* sem)
     return ret;
 }
 
+int post_all_sem_sync(Semaphore* sem)
+{
+    int ret = -1;
+    _lock_sem(sem);
+    do
+        _post_sem_sync(sem), ret++;
+    while (!_get_sem(sem));
+    _unlock_sem(sem);
+    return ret;
+}
+
 void _lock_sem(Semaphore* sem)
 {
     _acquire_spinlock(&sem->lock);
@@ -69,7 +88,7 @@ bool _wait_sem(Semaphore* sem, bool alertable)
         release_spinlock(0, &sem->lock);
         return true;
     }
-    WaitData* wait = kalloc(sizeof(WaitData));
+    WaitData* wait = kmem_cache_alloc(wait_cache);
     wait->proc = thisproc();
     wait->up = false;
     _insert_into_list(&sem->sleeplist, &wait->slnode);
@@ -84,11 +103,11 @@ bool _wait_sem(Semaphore* sem, bool alertable)
     }
     release_spinlock(0, &sem->lock);
     bool ret = wait->up;
-    kfree(wait);
+    kmem_cache_free(wait_cache, wait);
     return ret;
 }
 
-void _post_sem(Semaphore* sem)
+static void __post_sem(Semaphore* sem, bool sync)
 {
     if (++sem->val <= 0)
     {
@@ -96,6 +115,16 @@ void _post_sem(Semaphore* sem)
         auto wait = container_of(sem->sleeplist.prev, WaitData, slnode);
         wait->up = true;
         _detach_from_list(&wait->slnode);
-        activate_proc(wait->proc);
+        _activate_proc(wait->proc, false, sync);
     }
+}
+
+void _post_sem(Semaphore* sem)
+{
+    __post_sem(sem, false);
+}
+
+void _post_sem_sync(Semaphore* sem)
+{
+    __post_sem(sem, true);
 }
\ No newline at end of file
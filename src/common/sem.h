@@ -18,12 +18,15 @@ typedef struct {
 void init_sem(Semaphore*, int val);
 int get_all_sem(Semaphore*);
 int post_all_sem(Semaphore*);
+// the caller is about to sleep, see activate_proc_sync()
+int post_all_sem_sync(Semaphore*);
 bool _get_sem(Semaphore*);
 WARN_RESULT int _query_sem(Semaphore*);
 void _lock_sem(Semaphore*);
 void _unlock_sem(Semaphore*);
 WARN_RESULT bool _wait_sem(Semaphore*, bool alertable);
 void _post_sem(Semaphore*);
+void _post_sem_sync(Semaphore*);
 #define lock_sem(checker, sem) checker_begin_ctx_before_call(checker, _lock_sem, sem)
 #define unlock_sem(checker, sem) checker_end_ctx_after_call(checker, _unlock_sem, sem)
 #define prelocked_wait_sem(checker, sem) checker_end_ctx_after_call(checker, _wait_sem, sem, true)
@@ -55,7 +55,12 @@ void free_buf(struct socket_buf* buf){
     kfree(buf);
 }
 
+// The user buffer is only touched with the lock dropped, through a buffer
+// on the kernel stack: a fault on it may sleep to swap the page in.
+#define SOCKET_COPY 128
+
 int buf_read(struct socket_buf* buf, u64 addr, usize size, bool send){
+    char kbuf[SOCKET_COPY];
     int page_no = send ? SOCKET_SNDBUF_PAGENO: SOCKET_RCVBUF_PAGENO;
     u64* pages = send ? buf->snd_buf->pages : buf->rcv_buf->pages;
     u64* r = send ? &buf->snd_buf->r : &buf->rcv_buf->r;
@@ -74,12 +79,18 @@ int buf_read(struct socket_buf* buf, u64 addr, usize size, bool send){
     }
 
     usize ret = 0;
-    while(ret < size){
-        if(*w == *r)break;
-        auto page_idx = (*r / PAGE_SIZE) % page_no;
-        auto in_page_data_idx = *r % PAGE_SIZE;
-        (*r)++;
-        ((char*)addr)[ret++] = ((char*)pages[page_idx])[in_page_data_idx];
+    while(ret < size && *w != *r){
+        usize k = 0;
+        while(k < SOCKET_COPY && ret + k < size && *w != *r){
+            auto page_idx = (*r / PAGE_SIZE) % page_no;
+            auto in_page_data_idx = *r % PAGE_SIZE;
+            (*r)++;
+            kbuf[k++] = ((char*)pages[page_idx])[in_page_data_idx];
+        }
+        _release_spinlock(lock);
+        memcpy((char*)addr + ret, kbuf, k);
+        ret += k;
+        _acquire_spinlock(lock);
     }
     post_all_sem(w_sem);
     _release_spinlock(lock);
@@ -87,6 +98,7 @@ int buf_read(struct socket_buf* buf, u64 addr, usize size, bool send){
 }
 
 int buf_write(struct socket_buf* buf, u64 addr, usize size, bool send){
+    char kbuf[SOCKET_COPY];
     int page_no = send ? SOCKET_SNDBUF_PAGENO: SOCKET_RCVBUF_PAGENO;
     u64* pages = send ? buf->snd_buf->pages : buf->rcv_buf->pages;
     u64* r = send ? &buf->snd_buf->r : &buf->rcv_buf->r;
@@ -99,20 +111,27 @@ int buf_write(struct socket_buf* buf, u64 addr, usize size, bool send){
 
     usize ret = 0;
     while(ret < size){
-        if(*w - *r >= (u64)(PAGE_SIZE * page_no)){
-            post_all_sem(r_sem);
-            _release_spinlock(lock);
-            if(!_wait_sem(w_sem, true)){
-                return ret;
+        usize len = MIN(size - ret, (usize)SOCKET_COPY), i = 0;
+        _release_spinlock(lock);
+        memcpy(kbuf, (char*)addr + ret, len);
+        _acquire_spinlock(lock);
+        while(i < len){
+            if(*w - *r >= (u64)(PAGE_SIZE * page_no)){
+                post_all_sem_sync(r_sem);
+                _release_spinlock(lock);
+                if(!_wait_sem(w_sem, true)){
+                    return ret + i;
+                }
+                _acquire_spinlock(lock);
+            }
+            else{
+                auto page_idx = (*w / PAGE_SIZE) % page_no;
+                auto in_page_data_idx = *w % PAGE_SIZE;
+                (*w)++;
+                ((char*)pages[page_idx])[in_page_data_idx] = kbuf[i++];
             }
-            _acquire_spinlock(lock);
-        }
-        else{
-            auto page_idx = (*w / PAGE_SIZE) % page_no;
-            auto in_page_data_idx = *w % PAGE_SIZE;
-            (*w)++;
-            ((char*)pages[page_idx])[in_page_data_idx] = ((char*)addr)[ret++];
         }
+        ret += len;
     }
     post_all_sem(r_sem);
     _release_spinlock(lock);
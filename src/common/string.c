@@ -1,23 +1,158 @@
 #include <common/string.h>
 
+// The mem* functions move 64 bytes per loop iteration with ldp/stp of
+// general registers (the kernel is built with -mgeneral-regs-only), after
+// aligning the destination. Normal memory allows unaligned accesses
+// (SCTLR_EL1.A is clear), so the source may stay unaligned. Large zero
+// fills use DC ZVA, which clears a whole block without reading it.
+
+// unaligned 64-bit access
+typedef u64 __attribute__((may_alias, aligned(1))) u64_u;
+
+// bytes cleared by DC ZVA, 0 if it is prohibited, -1 before the first read
+static isize zva_size = -1;
+
+static usize _zva_size() {
+    if (zva_size < 0) {
+        u64 dczid;
+        asm volatile("mrs %0, dczid_el0" : "=r"(dczid));
+        zva_size = (dczid & 16) ? 0 : 4 << (dczid & 15);
+    }
+    return (usize)zva_size;
+}
+
+// n > 0 blocks of 64 bytes, d is 16-byte aligned
+static void _set64(u8 *d, u64 v, usize n) {
+    asm volatile("1:\n"
+                 "stp %[v], %[v], [%[d]]\n"
+                 "stp %[v], %[v], [%[d], #16]\n"
+                 "stp %[v], %[v], [%[d], #32]\n"
+                 "stp %[v], %[v], [%[d], #48]\n"
+                 "add %[d], %[d], #64\n"
+                 "subs %[n], %[n], #1\n"
+                 "b.ne 1b\n"
+                 : [d] "+r"(d), [n] "+r"(n)
+                 : [v] "r"(v)
+                 : "memory", "cc");
+}
+
+// n > 0 blocks of `bs` bytes, d is aligned to bs
+static void _zva(u8 *d, usize bs, usize n) {
+    asm volatile("1:\n"
+                 "dc zva, %[d]\n"
+                 "add %[d], %[d], %[bs]\n"
+                 "subs %[n], %[n], #1\n"
+                 "b.ne 1b\n"
+                 : [d] "+r"(d), [n] "+r"(n)
+                 : [bs] "r"(bs)
+                 : "memory", "cc");
+}
+
+// n > 0 blocks of 64 bytes, forwards
+static void _copy64(u8 *d, const u8 *s, usize n) {
+    u64 a, b, c, e;
+    asm volatile("1:\n"
+                 "ldp %[a], %[b], [%[s]]\n"
+                 "ldp %[c], %[e], [%[s], #16]\n"
+                 "stp %[a], %[b], [%[d]]\n"
+                 "stp %[c], %[e], [%[d], #16]\n"
+                 "ldp %[a], %[b], [%[s], #32]\n"
+                 "ldp %[c], %[e], [%[s], #48]\n"
+                 "stp %[a], %[b], [%[d], #32]\n"
+                 "stp %[c], %[e], [%[d], #48]\n"
+                 "add %[s], %[s], #64\n"
+                 "add %[d], %[d], #64\n"
+                 "subs %[n], %[n], #1\n"
+                 "b.ne 1b\n"
+                 : [d] "+r"(d), [s] "+r"(s), [n] "+r"(n), [a] "=&r"(a),
+                   [b] "=&r"(b), [c] "=&r"(c), [e] "=&r"(e)
+                 :
+                 : "memory", "cc");
+}
+
+// n > 0 blocks of 64 bytes ending at d and s, backwards
+static void _copy64_back(u8 *d, const u8 *s, usize n) {
+    u64 a, b, c, e;
+    asm volatile("1:\n"
+                 "ldp %[a], %[b], [%[s], #-16]\n"
+                 "ldp %[c], %[e], [%[s], #-32]\n"
+                 "stp %[a], %[b], [%[d], #-16]\n"
+                 "stp %[c], %[e], [%[d], #-32]\n"
+                 "ldp %[a], %[b], [%[s], #-48]\n"
+                 "ldp %[c], %[e], [%[s], #-64]\n"
+                 "stp %[a], %[b], [%[d], #-48]\n"
+                 "stp %[c], %[e], [%[d], #-64]\n"
+                 "sub %[s], %[s], #64\n"
+                 "sub %[d], %[d], #64\n"
+                 "subs %[n], %[n], #1\n"
+                 "b.ne 1b\n"
+                 : [d] "+r"(d), [s] "+r"(s), [n] "+r"(n), [a] "=&r"(a),
+                   [b] "=&r"(b), [c] "=&r"(c), [e] "=&r"(e)
+                 :
+                 : "memory", "cc");
+}
+
 void *memset(void *s, int c, usize n) {
-    for (usize i = 0; i < n; i++)
-        ((u8 *)s)[i] = (u8)(c & 0xff);
+    u8 *d = (u8 *)s;
+    u64 v = (u8)c * 0x0101010101010101ull;
+
+    if (n >= 64) {
+        for (; (u64)d & 15; n--)
+            *d++ = (u8)c;
+        usize bs = v == 0 ? _zva_size() : 0;
+        if (bs && n >= 2 * bs) {
+            for (; (u64)d & (bs - 1); d += 16, n -= 16)
+                *(u64 *)d = *(u64 *)(d + 8) = 0;
+            _zva(d, bs, n / bs);
+            d += n & ~(bs - 1);
+            n &= bs - 1;
+        }
+        if (n >= 64) {
+            _set64(d, v, n / 64);
+            d += n & ~63ull;
+            n &= 63;
+        }
+    }
+    for (; n >= 8; d += 8, n -= 8)
+        *(u64_u *)d = v;
+    for (; n; n--)
+        *d++ = (u8)c;
 
     return s;
 }
 
-void *memcpy(void *restrict dest, const void *restrict src, usize n) {
-    for (usize i = 0; i < n; i++)
-        ((u8 *)dest)[i] = ((u8 *)src)[i];
+// forwards, also correct for overlapping regions with dest below src
+static void _copy_forward(u8 *d, const u8 *s, usize n) {
+    if (n >= 64) {
+        for (; (u64)d & 15; n--)
+            *d++ = *s++;
+        if (n >= 64) {
+            _copy64(d, s, n / 64);
+            d += n & ~63ull;
+            s += n & ~63ull;
+            n &= 63;
+        }
+    }
+    for (; n >= 8; d += 8, s += 8, n -= 8)
+        *(u64_u *)d = *(const u64_u *)s;
+    for (; n; n--)
+        *d++ = *s++;
+}
 
+void *memcpy(void *restrict dest, const void *restrict src, usize n) {
+    _copy_forward((u8 *)dest, (const u8 *)src, n);
     return dest;
 }
 
 int memcmp(const void *s1, const void *s2, usize n) {
+    const u8 *a = (const u8 *)s1, *b = (const u8 *)s2;
+
+    // skip the equal words, the differing one is compared bytewise
+    for (; n >= 8 && *(const u64_u *)a == *(const u64_u *)b; a += 8, b += 8)
+        n -= 8;
     for (usize i = 0; i < n; i++) {
-        int c1 = ((u8 *)s1)[i];
-        int c2 = ((u8 *)s2)[i];
+        int c1 = a[i];
+        int c2 = b[i];
 
         if (c1 != c2)
             return c1 - c2;
@@ -27,19 +162,33 @@ int memcmp(const void *s1, const void *s2, usize n) {
 }
 
 void *memmove(void *dest, const void *src, usize n) {
-    const char *s = (const char *)src;
-    char *d = (char *)dest;
+    const u8 *s = (const u8 *)src;
+    u8 *d = (u8 *)dest;
 
     if (s < d && (usize)(d - s) < n) {
         s += n;
         d += n;
+        if (n >= 64) {
+            for (; (u64)d & 15; n--)
+                *--d = *--s;
+            if (n >= 64) {
+                _copy64_back(d, s, n / 64);
+                d -= n & ~63ull;
+                s -= n & ~63ull;
+                n &= 63;
+            }
+        }
+        // all loads of a word come before its store
+        for (; n >= 8; n -= 8) {
+            d -= 8;
+            s -= 8;
+            *(u64_u *)d = *(const u64_u *)s;
+        }
         while (n-- > 0) {
             *--d = *--s;
         }
     } else {
-        while (n-- > 0) {
-            *d++ = *s++;
-        }
+        _copy_forward(d, s, n);
     }
 
     return dest;
@@ -32,6 +32,13 @@ void reset_clock(u64 countdown_ms)
     u64 t = countdown_ms * clock.one_ms;
     ASSERT(t <= 0x7fffffff);
     asm volatile("msr cntp_tval_el0, %[x]" ::[x] "r"(t));
+    asm volatile("msr cntp_ctl_el0, %[x]" ::[x] "r"(1ll));
+}
+
+// disable the timer until the next reset_clock
+void stop_clock()
+{
+    asm volatile("msr cntp_ctl_el0, %[x]" ::[x] "r"(0ll));
 }
 
 void set_clock_handler(ClockHandler handler)
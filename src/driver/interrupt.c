@@ -2,6 +2,7 @@
 #include <driver/base.h>
 #include <driver/clock.h>
 #include <driver/interrupt.h>
+#include <driver/ipi.h>
 #include <driver/irq.h>
 #include <kernel/init.h>
 #include <kernel/printk.h>
@@ -36,6 +37,12 @@ void interrupt_global_handler()
         invoke_clock_handler();
     }
 
+    if (source & IRQ_SRC_MBOX0)
+    {
+        source ^= IRQ_SRC_MBOX0;
+        invoke_ipi_handler();
+    }
+
     if (source & IRQ_SRC_GPU)
     {
         source ^= IRQ_SRC_GPU;
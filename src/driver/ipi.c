@@ -0,0 +1,42 @@
+#include <aarch64/intrinsic.h>
+#include <driver/base.h>
+#include <driver/ipi.h>
+
+#define CORE_MBOX_CTRL(id)   (LOCAL_BASE + 0x50 + 4 * (id))
+#define CORE_MBOX_SET(id, n) (LOCAL_BASE + 0x80 + 0x10 * (id) + 4 * (n))
+#define CORE_MBOX_CLR(id, n) (LOCAL_BASE + 0xC0 + 0x10 * (id) + 4 * (n))
+#define CORE_MBOX_IRQ(n)     (1 << (n))
+
+// mailbox 0 of each core is used for IPIs
+#define IPI_MBOX 0
+
+static IpiHandler ipi_handler;
+
+void init_ipi()
+{
+    device_put_u32(CORE_MBOX_CLR(cpuid(), IPI_MBOX), 0xffffffff);
+    device_put_u32(CORE_MBOX_CTRL(cpuid()), CORE_MBOX_IRQ(IPI_MBOX));
+}
+
+void send_ipi(int cpu, u32 type)
+{
+    // make the memory updates visible before the target is interrupted
+    arch_dsb_sy();
+    device_put_u32(CORE_MBOX_SET(cpu, IPI_MBOX), type);
+}
+
+void set_ipi_handler(IpiHandler handler)
+{
+    ipi_handler = handler;
+}
+
+void invoke_ipi_handler()
+{
+    u64 mbox = CORE_MBOX_CLR(cpuid(), IPI_MBOX);
+    u32 type = device_get_u32(mbox);
+    device_put_u32(mbox, type);
+    arch_dsb_sy();
+    if (!ipi_handler)
+        PANIC();
+    ipi_handler(type);
+}
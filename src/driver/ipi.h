@@ -0,0 +1,14 @@
+#pragma once
+
+#include <common/defines.h>
+
+// inter-processor interrupts through the core mailboxes of BCM2836.
+// `type` is a bit mask, pending types of a cpu are merged.
+#define IPI_RESCHEDULE (1 << 0)
+
+typedef void (*IpiHandler)(u32 type);
+
+void init_ipi();
+void send_ipi(int cpu, u32 type);
+void set_ipi_handler(IpiHandler handler);
+void invoke_ipi_handler();
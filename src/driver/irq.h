@@ -21,6 +21,7 @@
 #define IRQ_SRC_CORE(i) (LOCAL_BASE + 0x60 + 4 * (i))
 #define IRQ_SRC_TIMER       (1 << 11) /* Local Timer */
 #define IRQ_SRC_GPU         (1 << 8)
+#define IRQ_SRC_MBOX0       (1 << 4)  /* Core Mailbox 0 */
 #define IRQ_SRC_CNTPNSIRQ   (1 << 1) /* Core Timer */
 #define FIQ_SRC_CORE(i)   (LOCAL_BASE + 0x70 + 4 * (i))
 
@@ -43,6 +43,8 @@ ALWAYS_INLINE u32 get_and_clear_EMMC_INTERRUPT() {
 static Queue sd_req_que;
 u32 P2_sLBA;
 u32 P2_num;
+u32 P3_sLBA;
+u32 P3_num;
 
 void sd_init() {
     /*
@@ -83,6 +85,9 @@ void sd_init() {
     u64 PE2 = (u64)&b.data + 0x1CE;
     P2_sLBA = *(u32*)(PE2 + 0x8);
     P2_num = *(u32*)(PE2 + 0xC);
+    u64 PE3 = (u64)&b.data + 0x1DE;
+    P3_sLBA = *(u32*)(PE3 + 0x8);
+    P3_num = *(u32*)(PE3 + 0xC);
     arch_dsb_sy();
 
     printk("Second partition LBA: %d\n", P2_sLBA);
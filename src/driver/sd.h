@@ -20,6 +20,9 @@
 
 u32 P2_sLBA;
 u32 P2_num;
+// the third partition is used for swap, if there is one
+extern u32 P3_sLBA;
+extern u32 P3_num;
 
 void sd_init();
 void sd_intr();
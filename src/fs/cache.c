@@ -42,6 +42,8 @@ static SpinLock lock;
  */
 static ListNode head;
 
+static struct kmem_cache* block_cache;
+
 static LogHeader header; // in-memory copy of log header block.
 
 /**
@@ -127,7 +129,7 @@ static Block *cache_acquire(usize block_no) {
     }
 
     if(ret == NULL){
-        ret = (Block*)kalloc(sizeof(Block));
+        ret = (Block*)kmem_cache_alloc(block_cache);
         init_block(ret);
         ret->block_no = block_no;
         _release_spinlock(&lock);
@@ -156,7 +158,7 @@ static void cache_release(Block *block) {
             if(block->ref == 0 && !block->pinned){
                 ListNode* prev = p->prev;
                 _detach_from_list(p);
-                kfree(block);
+                kmem_cache_free(block_cache, block);
                 bcache.num_cached_blocks--;
                 p = prev;
             }
@@ -185,6 +187,7 @@ void init_bcache(const SuperBlock *_sblock, const BlockDevice *_device) {
     device = _device;
 
     // TODO
+    if(!block_cache)block_cache = kmem_cache_create("block", sizeof(Block), NULL);
     read_header();
     _write_log_area_back();
     write_header();
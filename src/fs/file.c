@@ -83,12 +83,22 @@ int file_stat(struct file* f, struct stat* st) {
     return 0;
 }
 
+// Fault the pages of the buffer in before the inode is locked: a fault on a
+// page of an executable or of a mapped file locks its inode, which may be
+// this one. Those pages are not reclaimed, and a write fault on one of them
+// afterwards only copies it.
+static void _prefault(const char* addr, isize n) {
+    for(u64 va = PAGE_BASE((u64)addr); va < (u64)addr + (u64)n; va += PAGE_SIZE)
+        (void)*(volatile const char*)MAX(va, (u64)addr);
+}
+
 /* Read from file f. */
 isize file_read(struct file* f, char* addr, isize n) {
     /* TODO: LabFinal */
     if(!f->readable || f->type == FD_NONE)return -1;
     isize ret = 0;
     if(f->type == FD_INODE){
+        _prefault(addr, n);
         inodes.lock(f->ip);
         ret = (isize)inodes.read(f->ip, (u8*)addr, f->off, n);
         f->off += ret;
@@ -110,6 +120,7 @@ isize file_write(struct file* f, char* addr, isize n) {
         ASSERT(f->ip->inode_no > 9);
         usize wsz = MIN(INODE_MAX_BYTES - f->off, (usize)n);
         usize n_w = 0;
+        _prefault(addr, wsz);
         while(n_w != wsz){
             usize this = MIN(wsz - n_w, (usize)(OP_MAX_NUM_BLOCKS * BLOCK_SIZE / 2));
             OpContext ctx;
@@ -43,6 +43,8 @@ static SpinLock lock;
  */
 static ListNode head;
 
+static struct kmem_cache* inode_cache;
+
 // return which block `inode_no` lives on.
 static INLINE usize to_block_no(usize inode_no) {
     return sblock->inode_start + (inode_no / (INODE_PER_BLOCK));
@@ -58,8 +60,16 @@ static INLINE u32* get_addrs(Block* block) {
     return ((IndirectBlock*)block->data)->addrs;
 }
 
+static usize _inode_rw(OpContext* ctx,
+                       Inode* inode,
+                       u8* buffer,
+                       usize offset,
+                       usize count,
+                       bool do_write);
+
 // initialize inode tree.
 void init_inodes(const SuperBlock* _sblock, const BlockCache* _cache) {
+    if(!inode_cache)inode_cache = kmem_cache_create("inode", sizeof(Inode), NULL);
     init_spinlock(&lock);
     init_list_node(&head);
     sblock = _sblock;
@@ -79,6 +89,34 @@ static void init_inode(Inode* inode) {
     init_list_node(&inode->node);
     inode->inode_no = 0;
     inode->valid = false;
+    memset(inode->pages, 0, sizeof(inode->pages));
+}
+
+// drop the page cache of `inode`, mappings keep their own references.
+static void drop_pages(Inode* inode) {
+    for (usize i = 0; i < INODE_MAX_PAGES; i++) {
+        if (inode->pages[i]) {
+            kfree_page(inode->pages[i]);
+            inode->pages[i] = NULL;
+        }
+    }
+}
+
+// return cached page `index` of `inode`, reading it in on a miss.
+static void* cache_page(Inode* inode, usize index) {
+    if (index >= INODE_MAX_PAGES)
+        return NULL;
+    if (inode->pages[index] == NULL) {
+        void* page = kalloc_page_zeroed();
+        if (page == NULL)
+            return NULL;
+        usize begin = index * PAGE_SIZE;
+        usize end = MIN(begin + PAGE_SIZE, (usize)inode->entry.num_bytes);
+        if (begin < end)
+            _inode_rw(NULL, inode, page, begin, end - begin, false);
+        inode->pages[index] = page;
+    }
+    return inode->pages[index];
 }
 
 // see `inode.h`.
@@ -172,7 +210,7 @@ static Inode* inode_get(usize inode_no) {
     }
 
     if(ret == NULL){
-        ret = (Inode*)kalloc(sizeof(Inode));
+        ret = (Inode*)kmem_cache_alloc(inode_cache);
         init_inode(ret);
         ret->inode_no = inode_no;
         _increment_rc(&ret->rc);
@@ -209,6 +247,7 @@ static void inode_clear(OpContext* ctx, Inode* inode) {
         cache->release(indirect_block);
         cache->free(ctx, inode->entry.indirect); //free indirect block 
     }
+    drop_pages(inode);
     // reset some metadata
     inode->entry.num_bytes = 0;
     inode->entry.indirect = 0;
@@ -233,10 +272,12 @@ static void inode_put(OpContext* ctx, Inode* inode) {
         _acquire_spinlock(&lock);
         _detach_from_list(&inode->node);
         _release_spinlock(&lock);
+        drop_pages(inode);
         inode_unlock(inode);
-        kfree(inode);
+        kmem_cache_free(inode_cache, inode);
         return;
     }
+    if(inode->rc.count == 1)drop_pages(inode);
     inode_unlock(inode);
     _decrement_rc(&inode->rc);
 }
@@ -356,7 +397,15 @@ static usize inode_read(Inode* inode, u8* dest, usize offset, usize count) {
 
     if(offset == entry->num_bytes)ASSERT(count == 0);
     // TODO
-    return _inode_rw(NULL, inode, dest, offset, count, false);
+    for(usize done = 0, size; done < count; done += size){
+        usize off = offset + done;
+        size = MIN(PAGE_SIZE - off % PAGE_SIZE, count - done);
+        void* page = cache_page(inode, off / PAGE_SIZE);
+        // no memory for the cache, read the blocks directly
+        if(page == NULL)_inode_rw(NULL, inode, dest + done, off, size, false);
+        else memcpy(dest + done, page + off % PAGE_SIZE, size);
+    }
+    return count;
 }
 
 // see `inode.h`.
@@ -380,9 +429,23 @@ static usize inode_write(OpContext* ctx,
 
     auto ret = _inode_rw(ctx, inode, src, offset, count, true);
     inode_sync(ctx, inode, true);
+    // keep the cached pages up to date, `src` may be a mapped cache page
+    for(usize done = 0, size; done < count; done += size){
+        usize off = offset + done;
+        size = MIN(PAGE_SIZE - off % PAGE_SIZE, count - done);
+        void* page = inode->pages[off / PAGE_SIZE];
+        if(page)memmove(page + off % PAGE_SIZE, src + done, size);
+    }
     return ret;
 }
 
+// see `inode.h`.
+static void* inode_get_page(Inode* inode, usize index) {
+    void* page = cache_page(inode, index);
+    if(page)kshare_page((u64)page);
+    return page;
+}
+
 // see `inode.h`.
 static usize inode_lookup(Inode* inode, const char* name, usize* index) {
     InodeEntry* entry = &inode->entry;
@@ -452,6 +515,7 @@ InodeTree inodes = {
     .read = inode_read,
     .write = inode_write,
     .lookup = inode_lookup,
+    .get_page = inode_get_page,
     .insert = inode_insert,
     .remove = inode_remove,
 };
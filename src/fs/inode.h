@@ -1,4 +1,5 @@
 #pragma once
+#include <aarch64/mmu.h>
 #include <common/list.h>
 #include <common/rc.h>
 #include <common/spinlock.h>
@@ -11,6 +12,11 @@
  */
 #define ROOT_INODE_NO 1
 
+/**
+    @brief the number of pages needed to cache the largest file.
+ */
+#define INODE_MAX_PAGES ((INODE_MAX_BYTES + PAGE_SIZE - 1) / PAGE_SIZE)
+
 /**
     @brief an inode in memory.
 
@@ -59,6 +65,22 @@ typedef struct {
         @brief the real in-memory copy of the inode on disk.
      */
     InodeEntry entry; 
+
+    /**
+        @brief the page cache of the file content, indexed by page offset.
+
+        `pages[i]` holds bytes `[i * PAGE_SIZE, (i + 1) * PAGE_SIZE)` of the
+        file, or is NULL if that page has not been read in. Bytes past the
+        end of the file are zero.
+
+        Reads are served from here, writes go through to the blocks and
+        update the cached pages. A page can also be mapped into user space
+        by `mmap`, which holds its own reference to it.
+
+        @note protected by `lock`. Pages are dropped when the last reference
+        to the inode is put.
+     */
+    void* pages[INODE_MAX_PAGES];
 } Inode;
 
 /**
@@ -214,6 +236,20 @@ typedef struct {
      */
     usize (*lookup)(Inode* inode, const char* name, usize* index);
 
+    /**
+        @brief get page `index` of the page cache of `inode`, reading it in
+        from the blocks if it is not cached.
+
+        @return the kernel address of the page with one more reference taken
+        for the caller, who should `kfree_page` it when done. NULL if `index`
+        is past the largest file or there is no memory.
+
+        @note caller must hold the lock of `inode`.
+
+        @see `Inode::pages`.
+     */
+    void* (*get_page)(Inode* inode, usize index);
+
     /**
         @brief insert a new directory entry in directory `inode`.
         
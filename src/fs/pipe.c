@@ -59,8 +59,13 @@ void pipeClose(Pipe* pi, int writable) {
     _release_spinlock(&pi->lock);
 }
 
+// The user buffer is only touched with pi->lock dropped, through a buffer
+// on the kernel stack: a fault on it may sleep to swap the page in.
+#define PIPE_COPY 128
+
 int pipeWrite(Pipe* pi, u64 addr, usize n) {
     // TODO
+    char buf[PIPE_COPY];
     _acquire_spinlock(&pi->lock);
 
     if(!pi->writeopen){
@@ -70,21 +75,28 @@ int pipeWrite(Pipe* pi, u64 addr, usize n) {
 
     usize ret = 0;
     while(ret < n){
-        if(!pi->readopen){
-            _release_spinlock(&pi->lock);
-            return -1;
-        }
-        if(pi->nwrite - pi->nread >= PIPESIZE){
-            post_all_sem(&pi->rlock);
-            _release_spinlock(&pi->lock);
-            if(!_wait_sem(&pi->wlock, true)){
-                return ret;
+        usize len = MIN(n - ret, (usize)PIPE_COPY), i = 0;
+        _release_spinlock(&pi->lock);
+        memcpy(buf, (char*)addr + ret, len);
+        _acquire_spinlock(&pi->lock);
+        while(i < len){
+            if(!pi->readopen){
+                _release_spinlock(&pi->lock);
+                return -1;
+            }
+            if(pi->nwrite - pi->nread >= PIPESIZE){
+                post_all_sem_sync(&pi->rlock);
+                _release_spinlock(&pi->lock);
+                if(!_wait_sem(&pi->wlock, true)){
+                    return ret + i;
+                }
+                _acquire_spinlock(&pi->lock);
+            }
+            else{
+                pi->data[pi->nwrite++ % PIPESIZE] = buf[i++];
             }
-            _acquire_spinlock(&pi->lock);
-        }
-        else{
-            pi->data[pi->nwrite++ % PIPESIZE] = ((char*)addr)[ret++];
         }
+        ret += len;
     }
     post_all_sem(&pi->rlock);
     _release_spinlock(&pi->lock);
@@ -93,6 +105,7 @@ int pipeWrite(Pipe* pi, u64 addr, usize n) {
 
 int pipeRead(Pipe* pi, u64 addr, usize n) {
     // TODO
+    char buf[PIPESIZE];
     _acquire_spinlock(&pi->lock);
 
     if(!pi->readopen){
@@ -111,9 +124,10 @@ int pipeRead(Pipe* pi, u64 addr, usize n) {
     usize ret = 0;
     while(ret < n){
         if(pi->nwrite == pi->nread)break;
-        ((char*)addr)[ret++] = pi->data[pi->nread++ % PIPESIZE];
+        buf[ret++] = pi->data[pi->nread++ % PIPESIZE];
     }
     post_all_sem(&pi->wlock);
     _release_spinlock(&pi->lock);
+    memcpy((char*)addr, buf, ret);
     return ret;
 }
\ No newline at end of file
@@ -18,4 +18,35 @@ void* kalloc(isize x) {
 void kfree(void* object) {
     free(object);
 }
+
+struct kmem_cache {
+    usize size;
+    void (*ctor)(void*);
+};
+
+struct kmem_cache* kmem_cache_create(const char*, usize size, void (*ctor)(void*)) {
+    return new kmem_cache{size, ctor};
+}
+
+void* kmem_cache_alloc(struct kmem_cache* cache) {
+    void* object = malloc(cache->size);
+    if (cache->ctor)
+        cache->ctor(object);
+    return object;
+}
+
+void kmem_cache_free(struct kmem_cache*, void* object) {
+    free(object);
+}
+
+// page cache pages, with no sharing between mappings on the host
+void* kalloc_page_zeroed() {
+    return calloc(1, 4096);
+}
+
+void kfree_page(void* page) {
+    free(page);
+}
+
+void kshare_page(u64) {}
 }
@@ -161,6 +161,10 @@ int post_all_sem(Semaphore* x)
     _unlock_sem(x);
     return ret;
 }
+int post_all_sem_sync(Semaphore* x)
+{
+    return post_all_sem(x);
+}
 #undef sa
 #undef sb
 
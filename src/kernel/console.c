@@ -4,6 +4,7 @@
 #include<kernel/sched.h>
 #include<driver/uart.h>
 #include<driver/interrupt.h>
+#include<common/string.h>
 #define INPUT_BUF 128
 struct {
     char buf[INPUT_BUF];
@@ -25,29 +26,43 @@ define_rest_init(console){
     set_interrupt_handler(IRQ_AUX, console_interrupt_handler);
 }
 
+// user buffers are only touched with input.lock dropped, through a buffer
+// on the kernel stack: a fault on them may sleep to swap the page in
+
 isize console_write(Inode *ip, char *buf, isize n) {
     // TODO
     if(ip){}
-    _acquire_spinlock(&input.lock);
-    for(int i = 0; i < n; i++){
-        uart_put_char(buf[i]);
+    char kbuf[INPUT_BUF];
+    for(isize off = 0; off < n; off += INPUT_BUF){
+        isize len = MIN(n - off, (isize)INPUT_BUF);
+        memcpy(kbuf, buf + off, len);
+        _acquire_spinlock(&input.lock);
+        for(int i = 0; i < len; i++){
+            uart_put_char(kbuf[i]);
+        }
+        _release_spinlock(&input.lock);
     }
-    _release_spinlock(&input.lock);
     return n;
 }
 
 isize console_read(Inode *ip, char *dst, isize n) {
     // TODO
     if(ip){}
-    isize i = n;
+    char kbuf[INPUT_BUF];
+    isize i = n, k = 0;
     _acquire_spinlock(&input.lock);
     while(i){
-        if(input.r == input.w){
+        bool empty = input.r == input.w;
+        if(empty || k == INPUT_BUF){
             _release_spinlock(&input.lock);
-            if(wait_sem(&input.readable) == false){
+            memcpy(dst, kbuf, k);
+            dst += k;
+            k = 0;
+            if(empty && wait_sem(&input.readable) == false){
                 return -1;
             }
             _acquire_spinlock(&input.lock);
+            continue;
         }
         input.r = (input.r + 1) % INPUT_BUF;
         if(input.buf[input.r] == C('D')){
@@ -56,11 +71,12 @@ isize console_read(Inode *ip, char *dst, isize n) {
             }
             break;
         }
-        *(dst++) = input.buf[input.r];
+        kbuf[k++] = input.buf[input.r];
         i--;
         if(input.buf[input.r] == '\n')break;
     }
     _release_spinlock(&input.lock);
+    memcpy(dst, kbuf, k);
     return n - i;
 }
 
@@ -6,6 +6,8 @@
 #include <driver/sd.h>
 #include <kernel/mem.h>
 #include <kernel/paging.h>
+#include <driver/ipi.h>
+#include <kernel/swap.h>
 
 bool panic_flag;
 
@@ -15,7 +17,14 @@ NO_RETURN void idle_entry() {
         yield();
         if (panic_flag)
             break;
-        arch_with_trap { arch_wfi(); }
+        // nothing to run: prepare zeroed pages, and check for work again
+        // after every batch
+        if (zero_pool_refill())
+            continue;
+        // wait with traps disabled, so that an IPI which comes after
+        // yield() still wakes us up instead of being taken before wfi
+        arch_wfi();
+        arch_with_trap {}
     }
     set_cpu_off();
     arch_stop_cpu();
@@ -28,9 +37,11 @@ NO_RETURN void kernel_entry() {
     printk("hello world %d\n", (int)sizeof(struct proc));
 
     // proc_test();
+    // sched_bench();
     // vm_test();
     // sd_init();
     do_rest_init();
+    init_swap();
     // user_proc_test();
     // sd_test();
     // pgfault_first_test();
@@ -47,11 +58,12 @@ NO_RETURN void kernel_entry() {
     first->ucontext->sp = 0x800000;
     first->ucontext->spsr = 0;
 
-    struct section* st = (struct section*)kalloc(sizeof(struct section));
+    struct section* st = (struct section*)kmem_cache_alloc(section_cache);
+    memset(st, 0, sizeof(struct section));
     st->flags = ST_TEXT;
     st->begin = 0x400000;
     st->end = st->begin + (u64)eicode-(u64)icode;
-    _insert_into_list(&first->pgdir.section_head, &st->stnode);
+    section_insert(&first->pgdir, st);
     void* p = kalloc_page();
     memcpy(p, (void*)icode, PAGE_SIZE);
     vmmap(&first->pgdir, 0x400000, p, PTE_USER_DATA | PTE_RO);
@@ -69,6 +81,10 @@ NO_INLINE NO_RETURN void _panic(const char *file, int line) {
     printk("=====%s:%d PANIC%d!=====\n", file, line, cpuid());
     panic_flag = true;
     set_cpu_off();
+    for (int i = 0; i < NCPU; i++) {
+        if (i != cpuid())
+            send_ipi(i, IPI_RESCHEDULE);
+    }
     for (int i = 0; i < NCPU; i++) {
         if (cpus[i].online)
             i--;
@@ -2,6 +2,7 @@
 #include <kernel/printk.h>
 #include <kernel/init.h>
 #include <driver/clock.h>
+#include <driver/ipi.h>
 #include <kernel/sched.h>
 #include <kernel/proc.h>
 #include <aarch64/mmu.h>
@@ -23,7 +24,11 @@ static void __timer_set_clock()
     auto node = _rb_first(&cpus[cpuid()].timer);
     if (!node)
     {
+#if TICKLESS
+        stop_clock();
+#else
         reset_clock(1000);
+#endif
         return;
     }
     auto t1 = container_of(node, struct timer, _node)->_key;
@@ -35,7 +40,9 @@ static void __timer_set_clock()
 }
 
 static void timer_clock_handler() {
+#if !TICKLESS
     reset_clock(1000);
+#endif
     // printk("cpu %d aha\n", cpuid());
     while (1)
     {
@@ -49,6 +56,9 @@ static void timer_clock_handler() {
         timer->triggered = true;
         timer->handler(timer);
     }
+#if TICKLESS
+    __timer_set_clock();
+#endif
 }
 
 define_early_init(clock_handler) {
@@ -83,10 +93,13 @@ void set_cpu_on() {
     // disable the lower-half address to prevent stupid errors
     extern PTEntries invalid_pt;
     arch_set_ttbr0(K2P(&invalid_pt));
+    // the boot identity mapping is global and is not flushed by ASID
+    arch_tlbi_vmalle1();
     extern char exception_vector[];
     arch_set_vbar(exception_vector);
     arch_reset_esr();
     init_clock();
+    init_ipi();
     cpus[cpuid()].online = true;
     printk("CPU %d: hello\n", cpuid());
     hello_timer[cpuid()].elapse = 5000;
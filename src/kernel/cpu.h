@@ -5,6 +5,10 @@
 
 #define NCPU 4
 
+// stop the clock of a cpu when it has no pending timer, and do not
+// tick a cpu which has only one runnable process
+#define TICKLESS 1
+
 struct timer
 {
     bool triggered;
@@ -9,16 +9,20 @@
 #include <kernel/mem.h>
 #include <kernel/paging.h>
 #include <aarch64/trap.h>
+#include <aarch64/fpsimd.h>
 #include <fs/file.h>
 #include <fs/inode.h>
 #include <kernel/printk.h>
 
 //static u64 auxv[][2] = {{AT_PAGESZ, PAGE_SIZE}};
 extern int fdalloc(struct file* f);
+void set_parent_to_this(struct proc *proc);
 void trap_return();
 
-int execve(const char *path, char *const argv[], char *const envp[]) {
-	// TODO
+// Load the program at `path` into a new address space with argv and envp on
+// its stack, return it with the entry point and the initial sp, or NULL.
+// The strings are read from the address space of the caller.
+static struct pgdir* load_program(const char *path, char *const argv[], char *const envp[], u64* entry, u64* sp_out) {
 	OpContext ctx;
 	bcache.begin_op(&ctx);
 	Inode* node = namei(path, &ctx);
@@ -26,7 +30,7 @@ int execve(const char *path, char *const argv[], char *const envp[]) {
 	if(!node){
 		bcache.end_op(&ctx);
 		printk("(Error): %s not found\n", path);
-		return -1;
+		return NULL;
 	}
 
 	unsigned char e_ident[EI_NIDENT];
@@ -40,7 +44,7 @@ int execve(const char *path, char *const argv[], char *const envp[]) {
 		inodes.put(&ctx, node);
 		bcache.end_op(&ctx);
 		printk("(Error):File format not supported");
-		return -1;
+		return NULL;
 	}
 	else{
 		// only 64-bit format implemented
@@ -48,11 +52,12 @@ int execve(const char *path, char *const argv[], char *const envp[]) {
 		// read elf header
 		Elf64_Ehdr* ehdr = (Elf64_Ehdr*)kalloc(sizeof(Elf64_Ehdr));
 		if(inodes.read(node, (u8*)ehdr, 0, sizeof(Elf64_Ehdr)) != sizeof(Elf64_Ehdr)){
+			kfree(ehdr);
 			inodes.unlock(node);
 			inodes.put(&ctx, node);
 			bcache.end_op(&ctx);
 			printk("(Error): Elf header maybe corrupted");
-			return -1;
+			return NULL;
 		};
 		
 		// simple check of the elf file
@@ -62,7 +67,7 @@ int execve(const char *path, char *const argv[], char *const envp[]) {
 			inodes.put(&ctx, node);
 			bcache.end_op(&ctx);
 			printk("(Error): Elf file is corrupted");
-			return -1;
+			return NULL;
 		}
 
 		// read all program headers
@@ -79,8 +84,10 @@ int execve(const char *path, char *const argv[], char *const envp[]) {
 				inodes.put(&ctx, node);
 				bcache.end_op(&ctx);
 				free_pgdir(new_pd);
+				kfree(new_pd);
+				kfree(ehdr);
 				printk("(Error): Failed to read program header");
-				return -1;
+				return NULL;
 			}
 			// ignore unloadable program headers
 			if(phdr.p_type == PT_LOAD){
@@ -88,10 +95,8 @@ int execve(const char *path, char *const argv[], char *const envp[]) {
 				top_of_sections = MAX(top_of_sections, phdr.p_vaddr + phdr.p_memsz);
 
 				// init corresponding section
-				struct section* st = (struct section*)kalloc(sizeof(struct section));
+				struct section* st = (struct section*)kmem_cache_alloc(section_cache);
 				memset(st, 0, sizeof(struct section));
-				init_list_node(&st->stnode);
-				_insert_into_list(&new_pd->section_head, &st->stnode);
 				st->begin = phdr.p_paddr;
 				switch (phdr.p_flags){
 					case PF_R | PF_X:
@@ -100,76 +105,38 @@ int execve(const char *path, char *const argv[], char *const envp[]) {
 						st->end = st->begin + phdr.p_filesz;
 						break;
 					case PF_R | PF_W:
-						// data and bss sections
-						st->flags = ST_DATA;
-						st->end = st->begin + phdr.p_memsz;
-						break;
+						// data and bss sections, mapped from the page cache so
+						// the file offset must be page aligned with the address
+						if(VA_OFFSET(phdr.p_offset) == VA_OFFSET(phdr.p_vaddr)){
+							st->flags = ST_DATA;
+							st->end = st->begin + phdr.p_memsz;
+							break;
+						}
+						// fall through
 					default:
+						kmem_cache_free(section_cache, st);
 						inodes.unlock(node);
 						inodes.put(&ctx, node);
 						bcache.end_op(&ctx);
 						free_pgdir(new_pd);
+						kfree(new_pd);
+						kfree(ehdr);
 						printk("(Error): Invalid program header type");
-						return -1;
-				}
-				if(st->flags == ST_TEXT){
-					// Lazy Allocation
-					// set the file and offset
-					st->fp = file_alloc();
-					st->fp->ip = inodes.share(node);
-					st->fp->readable = true;
-					st->fp->writable = false;
-					st->fp->ref = 1;
-					st->fp->off = 0;
-					st->fp->type = FD_INODE;
-					st->length = phdr.p_filesz;
-					st->offset = phdr.p_offset;
-				}
-				else{
-					// map data and bss section
-					// [p_vaddr + p_filesz, p_vaddr + p_memsz) is the bss section
-					// set bss section to 0
-					u64 fsz = phdr.p_filesz, offset = phdr.p_offset, va = phdr.p_vaddr;
-					while(fsz){
-						u64 cur_page_left = PAGE_SIZE - VA_OFFSET(va);
-						u64 cur_writable_sz = MIN(fsz, cur_page_left);
-						void *p = kalloc_page();
-						memset(p, 0, PAGE_SIZE);
-						vmmap(new_pd, PAGE_BASE(va), p, PTE_USER_DATA | PTE_RW);
-						if(inodes.read(node, (u8*)(p + VA_OFFSET(va)), offset, cur_writable_sz) != cur_writable_sz){
-							inodes.unlock(node);
-							inodes.put(&ctx, node);
-							bcache.end_op(&ctx);
-							free_pgdir(new_pd);
-							printk("(Error): Failed to read data and bss section\n");
-							return -1;
-						}
-						fsz -= cur_writable_sz;
-						offset += cur_writable_sz;
-						va += cur_writable_sz;
-					}
-
-					// va now is p_vaddr + p_filesz
-					ASSERT(va == phdr.p_vaddr + phdr.p_filesz);
-					if(va != PAGE_BASE(va)){
-						// current page is already set to 0
-						// change to next possible page
-						va = PAGE_BASE(va) + PAGE_SIZE;
-					}
-					
-					if(phdr.p_memsz > va - phdr.p_paddr){
-						fsz = phdr.p_memsz - (va - phdr.p_vaddr);
-						while(fsz > 0){
-							// there are still pages of bss section
-							u64 cur_write_sz = MIN(PAGE_SIZE - VA_OFFSET(va), fsz);
-							vmmap(new_pd, PAGE_BASE(va), get_zero_page(), PTE_USER_DATA | PTE_RO);
-							fsz -= cur_write_sz;
-							va += cur_write_sz;
-						}
-						// va now is p_vaddr + p_memsz
-						ASSERT(va == phdr.p_vaddr + phdr.p_memsz);
-					}
+						return NULL;
 				}
+				section_insert(new_pd, st);
+				// Lazy Allocation
+				// set the file and offset, text is read on the first fault in
+				// it, data and bss are paged in on demand, see pgfault_handler
+				st->fp = file_alloc();
+				st->fp->ip = inodes.share(node);
+				st->fp->readable = true;
+				st->fp->writable = false;
+				st->fp->ref = 1;
+				st->fp->off = 0;
+				st->fp->type = FD_INODE;
+				st->length = phdr.p_filesz;
+				st->offset = phdr.p_offset;
 			}
 		}
 		inodes.unlock(node);
@@ -177,32 +144,21 @@ int execve(const char *path, char *const argv[], char *const envp[]) {
 		bcache.end_op(&ctx);
 
 		// init the heap section
-		_for_in_list(p, &new_pd->section_head){
-			if(p == &new_pd->section_head)continue;
-			struct section* st = container_of(p, struct section, stnode);
-			if(st->flags == ST_HEAP){
-				st->begin = st->end = PAGE_BASE(top_of_sections) + PAGE_SIZE;
-				// make sure there are enough space for user stack
-				ASSERT(st->end < TOP_USER_STACK - USER_STACK_SIZE);
-				break;
-			}
-		} 
+		u64 heap_begin = PAGE_BASE(top_of_sections) + PAGE_SIZE;
+		section_resize(new_pd, new_pd->heap, heap_begin, heap_begin);
+		// make sure there are enough space for user stack
+		ASSERT(heap_begin < TOP_USER_STACK - USER_STACK_SIZE);
 
-		// create and init user stack
+		// create and init user stack, its pages are allocated by copyout
+		// for the arguments and by page faults as it grows
 		u64 sp = TOP_USER_STACK - RESERVED_SIZE;	// reserved
-		for(u64 i = 1; i <= USER_STACK_SIZE / PAGE_SIZE; i++){
-			void* p = kalloc_page();
-			memset(p, 0, PAGE_SIZE);
-			vmmap(new_pd, TOP_USER_STACK - i * PAGE_SIZE, p, PTE_USER_DATA | PTE_RW);
-		}
 
-		struct section* st_ustack = (struct section*)kalloc(sizeof(struct section));
+		struct section* st_ustack = (struct section*)kmem_cache_alloc(section_cache);
 		memset(st_ustack, 0, sizeof(struct section));
 		st_ustack->begin = TOP_USER_STACK - USER_STACK_SIZE;
 		st_ustack->end = TOP_USER_STACK;
 		st_ustack->flags = ST_USER_STACK;
-		init_list_node(&st_ustack->stnode);
-		_insert_into_list(&new_pd->section_head, &st_ustack->stnode);
+		section_insert(new_pd, st_ustack);
 
 		// fill initial user stack content
 		u64 argc = 0, arg_len = 0, envc = 0, env_len = 0, zero = 0;
@@ -252,18 +208,89 @@ int execve(const char *path, char *const argv[], char *const envp[]) {
 		sp -= 8;
 		copyout(new_pd, (void*)sp, &argc, 8);
 
-		auto this = thisproc();
-		this->ucontext->sp = sp;
-
-		free_pgdir(&this->pgdir);
-		this->ucontext->elr = ehdr->e_entry;
-		memcpy(&this->pgdir, new_pd, sizeof(struct pgdir));
-		init_list_node(&this->pgdir.section_head);
-		_insert_into_list(&new_pd->section_head, &this->pgdir.section_head);
-		_detach_from_list(&new_pd->section_head);
-		kfree(new_pd);
-		attach_pgdir(&this->pgdir);
-		return 0;
+		*entry = ehdr->e_entry;
+		*sp_out = sp;
+		kfree(ehdr);
+		return new_pd;
 	}
 	PANIC();
 }
+
+int execve(const char *path, char *const argv[], char *const envp[]) {
+	u64 entry, sp;
+	struct pgdir* new_pd = load_program(path, argv, envp, &entry, &sp);
+	if(!new_pd)
+		return -1;
+
+	auto this = thisproc();
+	this->ucontext->sp = sp;
+	// a child of vfork gives the address space back to its parent
+	put_pgdir(this);
+	fpsimd_release();
+	this->ucontext->elr = entry;
+	move_pgdir(&this->pgdir, new_pd);
+	kfree(new_pd);
+	attach_pgdir(&this->pgdir);
+	return 0;
+}
+
+// check the actions against the files the child gets from copy_files()
+static bool check_spawn_actions(struct oftable* ft, const struct spawn_action* actions, int nactions) {
+	bool open[NOFILE] = {false};
+	for(int i = 0; i < NOFILE && ft->files[i] && ft->files[i]->type != FD_SOCKET; i++)
+		open[i] = true;
+	for(int i = 0; i < nactions; i++){
+		auto a = &actions[i];
+		if(a->fd < 0 || a->fd >= NOFILE)
+			return false;
+		if(a->type == SPAWN_CLOSE)
+			open[a->fd] = false;
+		else if(a->type == SPAWN_DUP2){
+			if(a->newfd < 0 || a->newfd >= NOFILE || !open[a->fd])
+				return false;
+			open[a->newfd] = true;
+		}
+		else
+			return false;
+	}
+	return true;
+}
+
+static void do_spawn_actions(struct oftable* ft, const struct spawn_action* actions, int nactions) {
+	for(int i = 0; i < nactions; i++){
+		auto a = &actions[i];
+		if(a->type == SPAWN_DUP2 && a->newfd == a->fd)
+			continue;
+		int fd = a->type == SPAWN_CLOSE ? a->fd : a->newfd;
+		if(ft->files[fd]){
+			file_close(ft->files[fd]);
+			ft->files[fd] = NULL;
+		}
+		if(a->type == SPAWN_DUP2)
+			ft->files[fd] = file_dup(ft->files[a->fd]);
+	}
+}
+
+int spawn(const char *path, char *const argv[], char *const envp[], const struct spawn_action *actions, int nactions) {
+	auto this = thisproc();
+	if(!check_spawn_actions(&this->oftable, actions, nactions))
+		return -1;
+	u64 entry, sp;
+	struct pgdir* new_pd = load_program(path, argv, envp, &entry, &sp);
+	if(!new_pd)
+		return -1;
+
+	auto new = create_proc();
+	new->schinfo.nice = this->schinfo.nice;
+	set_parent_to_this(new);
+	copy_files(this, new);
+	do_spawn_actions(&new->oftable, actions, nactions);
+
+	free_pgdir(&new->pgdir);
+	move_pgdir(&new->pgdir, new_pd);
+	kfree(new_pd);
+	memset((void*)new->ucontext, 0, sizeof(UserContext));
+	new->ucontext->elr = entry;
+	new->ucontext->sp = sp;
+	return start_proc(new, trap_return, 0);
+}
@@ -9,6 +9,9 @@
 #include <driver/memlayout.h>
 #include <kernel/init.h>
 #include <kernel/mem.h>
+#include <kernel/cpu.h>
+#include <common/string.h>
+#include <kernel/swap.h>
 
 #define K_DEBUG 0
 
@@ -23,41 +26,109 @@ RefCount alloc_page_cnt;
 
 define_early_init(alloc_page_cnt) { init_rc(&alloc_page_cnt); }
 
-typedef struct block_header_t
-{
-    // 一般情况下next是下一个块的内核虚拟地址的值
-    // 如果next是一个page的头地址，表示该block属于该page，并且被申请使用
-    u64 next;
-}block_header_t;
+static SpinLock kmem_lock;
 
-typedef struct page_header_t
-{
-    // 用于链接的链表节点
-    ListNode node;
-    // 该page中可分配块的空闲链表的头指针
-    block_header_t* free_blocks_head;
-    // 该page中的块可分配大小（即除开block_header_t的长度）均为8 * key
-    i32 key;
-    // 记录该page中有多少个块被申请后还未被释放
-    u32 ref;
-}page_header_t;
+// free pages are kept in a global buddy allocator and a magazine on each cpu
+// a magazine is only touched by its own cpu: the kernel is not preemptive
+// and traps are masked in kernel mode, so it needs no lock; it refills from
+// and drains to the buddy allocator MAG_BATCH pages at a time
+#define MAG_SIZE 64
+#define MAG_BATCH 32
 
-#define MAX_BLOCK_SIZE (PAGE_SIZE - sizeof(page_header_t) - sizeof(block_header_t))
-#define PAGE_ALLOC_LEN (1 + MAX_BLOCK_SIZE / 8)
-#define MAX_KEY (MAX_BLOCK_SIZE / 8)
-static QueueNode* pages;
-static ListNode* page_alloc[PAGE_ALLOC_LEN];
+struct page_magazine {
+    int cnt;
+    void* pages[MAG_SIZE];
+};
 
-static SpinLock kmem_lock;
+// buddy allocator: a free block of 2^order pages starts at a physical page
+// number aligned to 2^order, and is linked into free_area[order] through
+// its first bytes; _pages[] of its first page records `order` and `free`
+static ListNode free_area[BUDDY_MAX_ORDER + 1];
+static u64 nr_free[BUDDY_MAX_ORDER + 1];
+static SpinLock page_lock;
+static struct page_magazine mags[NCPU];
+
+#define PFN(page) (K2P(page) / PAGE_SIZE)
+#define PFN_PAGE(pfn) ((void*)P2K((u64)(pfn) * PAGE_SIZE))
+#define PFN_INFO(pfn) (&_pages[(pfn) - EXTMEM / PAGE_SIZE])
+
+struct page _pages[ALL_PAGE_COUNT];
 
 define_early_init(kmem_lock)
 {
     init_spinlock(&kmem_lock);
+    init_spinlock(&page_lock);
+    for(int i = 0; i <= BUDDY_MAX_ORDER; i++)
+        init_list_node(&free_area[i]);
+}
+
+static void _buddy_insert(u64 pfn, int order){
+    auto info = PFN_INFO(pfn);
+    info->free = true;
+    info->order = order;
+    _insert_into_list(&free_area[order], (ListNode*)PFN_PAGE(pfn));
+    nr_free[order]++;
+}
+
+static void _buddy_remove(u64 pfn, int order){
+    PFN_INFO(pfn)->free = false;
+    _detach_from_list((ListNode*)PFN_PAGE(pfn));
+    nr_free[order]--;
+}
+
+// take a block of 2^order pages, splitting a larger one if needed
+// page_lock must be held
+static void* _buddy_alloc(int order){
+    int o = order;
+    while(o <= BUDDY_MAX_ORDER && _empty_list(&free_area[o]))o++;
+    if(o > BUDDY_MAX_ORDER)return NULL;
+    u64 pfn = PFN(free_area[o].next);
+    _buddy_remove(pfn, o);
+    PFN_INFO(pfn)->order = order;
+    while(o > order){
+        o--;
+        _buddy_insert(pfn + (1ull << o), o);
+    }
+    return PFN_PAGE(pfn);
+}
+
+// give back a block of 2^order pages, merging it with its free buddies
+// page_lock must be held
+static void _buddy_free(void* page, int order){
+    u64 pfn = PFN(page);
+    while(order < BUDDY_MAX_ORDER){
+        u64 buddy = pfn ^ (1ull << order);
+        if(buddy < EXTMEM / PAGE_SIZE || buddy >= PHYSTOP / PAGE_SIZE)break;
+        auto info = PFN_INFO(buddy);
+        if(!info->free || info->order != order)break;
+        _buddy_remove(buddy, order);
+        pfn = MIN(pfn, buddy);
+        order++;
+    }
+    _buddy_insert(pfn, order);
+}
+
+// move up to MAG_BATCH pages from the buddy allocator into mag
+static void _mag_refill(struct page_magazine* mag){
+    _acquire_spinlock(&page_lock);
+    while(mag->cnt < MAG_BATCH){
+        void* p = _buddy_alloc(0);
+        if(!p)break;
+        mag->pages[mag->cnt++] = p;
+    }
+    _release_spinlock(&page_lock);
+}
+
+// move MAG_BATCH pages from mag back to the buddy allocator
+static void _mag_drain(struct page_magazine* mag){
+    _acquire_spinlock(&page_lock);
+    for(int i = 0; i < MAG_BATCH; i++)
+        _buddy_free(mag->pages[--mag->cnt], 0);
+    _release_spinlock(&page_lock);
 }
 
 extern char end[];
 static void* zero_page;
-struct page _pages[ALL_PAGE_COUNT];
 define_early_init(pages)
 {
     zero_page = (void*)(PAGE_BASE((u64)&end) + PAGE_SIZE);
@@ -65,18 +136,96 @@ define_early_init(pages)
         ((u8*)zero_page)[i] = 0;
     }
     for (u64 p = ((u64)zero_page + PAGE_SIZE); p < P2K(PHYSTOP); p += PAGE_SIZE)
-	   add_to_queue(&pages, (QueueNode*)p);
+        _buddy_free((void*)p, 0);
+}
+
+void* kalloc_pages(int order)
+{
+    if(order < 0 || order > BUDDY_MAX_ORDER)return NULL;
+    if(order == 0)return kalloc_page();
+    _acquire_spinlock(&page_lock);
+    void* page = _buddy_alloc(order);
+    _release_spinlock(&page_lock);
+    if(!page)return NULL;
+    for(int i = 0; i < (1 << order); i++)
+        _increment_rc(&alloc_page_cnt);
+    auto info = &_pages[PAGE_INDEX(page)];
+    ASSERT(info->ref.count == 0);
+    _increment_rc(&info->ref);
+    info->order = order;
+    return page;
 }
 
+void kfree_pages(void* page)
+{
+    auto info = &_pages[PAGE_INDEX(page)];
+    int order = info->order;
+    if(order == 0){
+        kfree_page(page);
+        return;
+    }
+    if(!_decrement_rc(&info->ref))return;
+    info->order = 0;
+    for(int i = 0; i < (1 << order); i++)
+        _decrement_rc(&alloc_page_cnt);
+    _acquire_spinlock(&page_lock);
+    _buddy_free(page, order);
+    _release_spinlock(&page_lock);
+}
+
+void split_pages(void* page)
+{
+    auto info = &_pages[PAGE_INDEX(page)];
+    ASSERT(info->ref.count == 1);
+    int order = info->order;
+    info->order = 0;
+    for(int i = 1; i < (1 << order); i++){
+        auto sub = &_pages[PAGE_INDEX(page + i * PAGE_SIZE)];
+        ASSERT(sub->ref.count == 0);
+        // left over from merges in the buddy allocator, kfree_pages()
+        // would free a block
+        sub->order = 0;
+        _increment_rc(&sub->ref);
+    }
+}
+
+void get_buddystat(struct buddystat* st)
+{
+    st->free_pages = 0;
+    st->largest_order = -1;
+    _acquire_spinlock(&page_lock);
+    for(int i = 0; i <= BUDDY_MAX_ORDER; i++){
+        st->nr_free[i] = nr_free[i];
+        st->free_pages += nr_free[i] << i;
+        if(nr_free[i])st->largest_order = i;
+    }
+    _release_spinlock(&page_lock);
+    // the share of free pages which can not serve an order-k request
+    u64 small = 0;
+    for(int i = 0; i <= BUDDY_MAX_ORDER; i++){
+        st->unusable[i] = st->free_pages ? small * 1000 / st->free_pages : 0;
+        small += st->nr_free[i] << i;
+    }
+}
+
+static void* _zero_pool_take();
+
 void* kalloc_page()
 {
-    _increment_rc(&alloc_page_cnt);
     // TODO
-    void* page = NULL;
-    if(pages) page = fetch_from_queue(&pages);
-    if(page) *(u64*)page = 0;
-    ASSERT(_pages[PAGE_INDEX(page)].ref.count == 0);
-    _increment_rc(&_pages[PAGE_INDEX(page)].ref);
+    auto mag = &mags[cpuid()];
+    if(mag->cnt == 0)_mag_refill(mag);
+    // the zero pool is the last reserve
+    if(mag->cnt == 0)return _zero_pool_take();
+    _increment_rc(&alloc_page_cnt);
+    if(left_page_cnt() < SWAP_LOW_PAGES)swap_kick();
+    void* page = mag->pages[--mag->cnt];
+    *(u64*)page = 0;
+    auto info = &_pages[PAGE_INDEX(page)];
+    ASSERT(info->ref.count == 0);
+    // a page freed by kfree_page() may be part of a split block
+    info->order = 0;
+    _increment_rc(&info->ref);
     return page;
 }
 
@@ -110,8 +259,89 @@ void kfree_page(void* p)
             printk("page:%p count: %llu\n", p, _pages[index].ref.count);
             PANIC();
         }
-        add_to_queue(&pages, (QueueNode*)p);
+        auto mag = &mags[cpuid()];
+        if(mag->cnt == MAG_SIZE)_mag_drain(mag);
+        mag->pages[mag->cnt++] = p;
+    }
+}
+
+// pool of zeroed pages, refilled by idle cpus so that page faults and page
+// table allocation need not clear the page themselves. Pages in the pool
+// are allocated pages with a reference count of 1.
+#define ZERO_POOL_SIZE 256
+#define ZERO_POOL_BATCH 8
+// leave this many free pages to the rest of the kernel
+#define ZERO_POOL_RESERVE 1024
+
+static struct {
+    SpinLock lock;
+    int cnt;
+    void* pages[ZERO_POOL_SIZE];
+    u64 refills;
+} zero_pool;
+static struct {
+    u64 hits, misses;
+} zero_pool_cpu[NCPU];
+
+define_early_init(zero_pool) { init_spinlock(&zero_pool.lock); }
+
+static void* _zero_pool_take(){
+    void* page = NULL;
+    _acquire_spinlock(&zero_pool.lock);
+    if(zero_pool.cnt > 0)page = zero_pool.pages[--zero_pool.cnt];
+    _release_spinlock(&zero_pool.lock);
+    return page;
+}
+
+void* kalloc_page_zeroed()
+{
+    void* page = _zero_pool_take();
+    if(page){
+        zero_pool_cpu[cpuid()].hits++;
+        return page;
+    }
+    zero_pool_cpu[cpuid()].misses++;
+    page = kalloc_page();
+    if(page)memset(page, 0, PAGE_SIZE);
+    return page;
+}
+
+bool zero_pool_refill()
+{
+    if(__atomic_load_n(&zero_pool.cnt, __ATOMIC_RELAXED) == ZERO_POOL_SIZE
+        || left_page_cnt() < ZERO_POOL_RESERVE)
+        return false;
+    int n = 0;
+    for(; n < ZERO_POOL_BATCH; n++){
+        void* page = kalloc_page();
+        if(!page)break;
+        memset(page, 0, PAGE_SIZE);
+        _acquire_spinlock(&zero_pool.lock);
+        bool full = zero_pool.cnt == ZERO_POOL_SIZE;
+        if(!full){
+            zero_pool.pages[zero_pool.cnt++] = page;
+            zero_pool.refills++;
+        }
+        _release_spinlock(&zero_pool.lock);
+        if(full){
+            kfree_page(page);
+            break;
+        }
     }
+    return n > 0;
+}
+
+void get_zero_pool_stat(struct zero_pool_stat* st)
+{
+    st->hits = st->misses = 0;
+    for(int i = 0; i < NCPU; i++){
+        st->hits += zero_pool_cpu[i].hits;
+        st->misses += zero_pool_cpu[i].misses;
+    }
+    _acquire_spinlock(&zero_pool.lock);
+    st->pooled = zero_pool.cnt;
+    st->refills = zero_pool.refills;
+    _release_spinlock(&zero_pool.lock);
 }
 
 u64 left_page_cnt() { 
@@ -125,83 +355,207 @@ WARN_RESULT void *get_zero_page() {
 }
 
 // TODO: kalloc kfree
-void div_page(page_header_t* page_header, isize block_size){
-    block_header_t* first = page_header->free_blocks_head;
-    isize remain = PAGE_SIZE - sizeof(page_header_t);
-    isize real_block_size = block_size + sizeof(block_header_t);
-    first = (block_header_t*)((u64)page_header + sizeof(page_header_t));
-    page_header->free_blocks_head = first;
-    while(remain >= real_block_size){
-        remain -= real_block_size;
-        if(remain < real_block_size)first->next = NULL;
-        else {
-            first->next = (u64)first + real_block_size;
-            first = (block_header_t*)first->next;
-        }
+
+// slab allocator: a kmem_cache carves pages (slabs) into objects of one
+// size, and each cpu caches a few free objects of every cache, so that
+// most allocations and frees touch no lock, for the same reason as the page
+// magazines. Objects move between the cpu caches and the slabs in batches
+// under the lock of the cache. A slab starts with its header, so objects
+// are never page aligned. kalloc uses a set of size classes on top of it,
+// larger requests go to kalloc_pages().
+
+#define SLAB_MAX_SIZE 2016
+#define MAX_KMEM_CACHES 32
+
+struct slab {
+    ListNode node;      // in `partial` of the cache if it has free objects
+    void* freelist;
+    struct kmem_cache* cache;
+    u16 inuse, total;
+};
+
+#define SLAB_HEADER_SIZE round_up(sizeof(struct slab), 16ull)
+
+struct kmem_cache_cpu {
+    int cnt;
+    void* objs[KMEM_CACHE_CPU_SIZE];
+    u64 allocs, hits, frees;
+};
+
+struct kmem_cache {
+    char name[KMEM_CACHE_NAME_LEN];
+    u32 size;
+    void (*ctor)(void*);
+    SpinLock lock;
+    ListNode partial;
+    // one empty slab is kept so that alloc/free ping-pong does not return
+    // the page every time
+    struct slab* empty;
+    u64 nr_slabs;
+    struct kmem_cache_cpu cpu[NCPU];
+};
+
+static struct kmem_cache kmem_caches[MAX_KMEM_CACHES];
+static int nr_kmem_caches;
+static SpinLock kmem_caches_lock;
+
+// the larger classes are chosen to fill a page after the header
+static const u32 kalloc_sizes[] = {16, 32, 48, 64, 96, 128, 192, 256, 336, 448, 576, 672, 800, 1008, 1344, 2016};
+#define NKALLOC_CLASS (int)(sizeof(kalloc_sizes) / sizeof(kalloc_sizes[0]))
+static struct kmem_cache* kalloc_caches[NKALLOC_CLASS];
+// size class of sizes in (16 * (i - 1), 16 * i]
+static u8 kalloc_class_of[SLAB_MAX_SIZE / 16 + 1];
+
+struct kmem_cache* kmem_cache_create(const char* name, usize size, void (*ctor)(void*))
+{
+    size = round_up((u64)MAX(size, 16ull), 16ull);
+    if(size > PAGE_SIZE - SLAB_HEADER_SIZE)PANIC();
+    _acquire_spinlock(&kmem_caches_lock);
+    if(nr_kmem_caches == MAX_KMEM_CACHES)PANIC();
+    auto cache = &kmem_caches[nr_kmem_caches++];
+    _release_spinlock(&kmem_caches_lock);
+    strncpy(cache->name, name, KMEM_CACHE_NAME_LEN - 1);
+    cache->size = size;
+    cache->ctor = ctor;
+    init_spinlock(&cache->lock);
+    init_list_node(&cache->partial);
+    return cache;
+}
+
+define_early_init(kalloc_caches)
+{
+    init_spinlock(&kmem_caches_lock);
+    int cls = 0;
+    for(int i = 0; i <= SLAB_MAX_SIZE / 16; i++){
+        while(kalloc_sizes[cls] < (u32)i * 16)cls++;
+        kalloc_class_of[i] = cls;
+    }
+    for(int i = 0; i < NKALLOC_CLASS; i++){
+        char name[KMEM_CACHE_NAME_LEN] = "kalloc-";
+        char* d = name + 7;
+        for(u32 k = 1000; k; k /= 10)
+            if(kalloc_sizes[i] >= k)*d++ = '0' + kalloc_sizes[i] / k % 10;
+        kalloc_caches[i] = kmem_cache_create(name, kalloc_sizes[i], NULL);
     }
 }
 
-page_header_t* init_page_header(void* page){
-    page_header_t* page_header;
-    block_header_t* block_header;
-    if(page == NULL)PANIC();
-    page_header = (page_header_t*)page;
-    block_header = (block_header_t*)((u64)page_header + sizeof(page_header_t));
-    page_header->free_blocks_head = block_header;
-    block_header->next = NULL;
-    page_header->key = (page_header->ref = 0);
-    init_list_node(&page_header->node);
-    return page_header;
+static struct slab* _slab_new(struct kmem_cache* cache){
+    struct slab* slab = kalloc_page();
+    if(!slab)return NULL;
+    slab->cache = cache;
+    slab->inuse = 0;
+    slab->total = (PAGE_SIZE - SLAB_HEADER_SIZE) / cache->size;
+    slab->freelist = NULL;
+    for(int i = slab->total - 1; i >= 0; i--){
+        void** obj = (void**)((u64)slab + SLAB_HEADER_SIZE + i * cache->size);
+        *obj = slab->freelist;
+        slab->freelist = obj;
+    }
+    init_list_node(&slab->node);
+    cache->nr_slabs++;
+    return slab;
 }
 
-void* kalloc(isize size){
-    void* alloc_ptr = NULL;
-    isize key = (size + 7) / 8;
-    page_header_t* page = NULL;
-    setup_checker(kalloc_checker);
-    acquire_spinlock(kalloc_checker, &kmem_lock);
-    if(page_alloc[key]){
-        _for_in_list(valptr, page_alloc[key]){
-            page = (page_header_t*)valptr;
-            if(page->free_blocks_head){
-                page_alloc[key] = _detach_from_list(valptr);
-                break;
+// move up to KMEM_CACHE_CPU_BATCH objects from the slabs into the cpu cache
+static void _cache_refill(struct kmem_cache* cache, struct kmem_cache_cpu* cc){
+    _acquire_spinlock(&cache->lock);
+    while(cc->cnt < KMEM_CACHE_CPU_BATCH){
+        struct slab* slab;
+        if(!_empty_list(&cache->partial))
+            slab = container_of(cache->partial.next, struct slab, node);
+        else{
+            if(cache->empty){
+                slab = cache->empty;
+                cache->empty = NULL;
             }
-            else page = NULL;
+            else if(!(slab = _slab_new(cache)))
+                break;
+            _insert_into_list(&cache->partial, &slab->node);
         }
+        while(cc->cnt < KMEM_CACHE_CPU_BATCH && slab->freelist){
+            void** obj = slab->freelist;
+            slab->freelist = *obj;
+            slab->inuse++;
+            // the free list link has overwritten the first word
+            if(cache->ctor)cache->ctor(obj);
+            cc->objs[cc->cnt++] = obj;
+        }
+        if(!slab->freelist)_detach_from_list(&slab->node);
     }
+    _release_spinlock(&cache->lock);
+}
 
-    if(!page){
-        page = init_page_header(kalloc_page());
-        page->key = key;
-        div_page(page, 8 * key);
+// move KMEM_CACHE_CPU_BATCH objects from the cpu cache back to their slabs
+static void _cache_flush(struct kmem_cache* cache, struct kmem_cache_cpu* cc){
+    _acquire_spinlock(&cache->lock);
+    for(int i = 0; i < KMEM_CACHE_CPU_BATCH; i++){
+        void** obj = cc->objs[--cc->cnt];
+        struct slab* slab = (struct slab*)PAGE_BASE((u64)obj);
+        if(!slab->freelist)_insert_into_list(&cache->partial, &slab->node);
+        *obj = slab->freelist;
+        slab->freelist = obj;
+        if(--slab->inuse == 0){
+            _detach_from_list(&slab->node);
+            if(cache->empty){
+                kfree_page(slab);
+                cache->nr_slabs--;
+            }
+            else cache->empty = slab;
+        }
     }
+    _release_spinlock(&cache->lock);
+}
+
+void* kmem_cache_alloc(struct kmem_cache* cache)
+{
+    auto cc = &cache->cpu[cpuid()];
+    cc->allocs++;
+    if(cc->cnt > 0)cc->hits++;
+    else _cache_refill(cache, cc);
+    if(cc->cnt == 0)return NULL;
+    return cc->objs[--cc->cnt];
+}
 
-    block_header_t* block = page->free_blocks_head;
-    alloc_ptr = (void*)((u64)block + sizeof(block_header_t));
-    page->free_blocks_head = (block_header_t*)block->next;
-    block->next = (u64)page;
-    page->ref++;
+void kmem_cache_free(struct kmem_cache* cache, void* obj)
+{
+    auto cc = &cache->cpu[cpuid()];
+    cc->frees++;
+    if(cc->cnt == KMEM_CACHE_CPU_SIZE)_cache_flush(cache, cc);
+    cc->objs[cc->cnt++] = obj;
+}
 
-    if(page_alloc[key])
-        _insert_into_list(page_alloc[key], &page->node);
-    page_alloc[key] = &page->node;
-    release_spinlock(kalloc_checker, &kmem_lock);
-    return alloc_ptr;
+int get_kmem_cache_stats(struct kmem_cache_stat* st, int n)
+{
+    int cnt = MIN(n, __atomic_load_n(&nr_kmem_caches, __ATOMIC_ACQUIRE));
+    for(int i = 0; i < cnt; i++){
+        auto cache = &kmem_caches[i];
+        memcpy(st[i].name, cache->name, KMEM_CACHE_NAME_LEN);
+        st[i].size = cache->size;
+        st[i].slabs = cache->nr_slabs;
+        st[i].allocs = st[i].hits = st[i].inuse = 0;
+        for(int c = 0; c < NCPU; c++){
+            st[i].allocs += cache->cpu[c].allocs;
+            st[i].hits += cache->cpu[c].hits;
+            st[i].inuse += cache->cpu[c].allocs - cache->cpu[c].frees;
+        }
+    }
+    return cnt;
 }
 
-void kfree(void* p){
-    setup_checker(kfree_checker);
-    acquire_spinlock(kfree_checker, &kmem_lock);
-    block_header_t* block = (block_header_t*)((u64)p - sizeof(block_header_t));
-    page_header_t* page = (page_header_t*)(block->next);
-    block->next = (u64)page->free_blocks_head;
-    page->free_blocks_head = block;
-    page->ref--;
-    if(page->ref == 0){
-        page_alloc[page->key] = _detach_from_list(&page->node);
-        kfree_page(page);
+void* kalloc(isize size){
+    if(size > SLAB_MAX_SIZE){
+        int order = 0;
+        while((PAGE_SIZE << order) < size)order++;
+        return kalloc_pages(order);
     }
-    release_spinlock(kfree_checker, &kmem_lock);
+    return kmem_cache_alloc(kalloc_caches[kalloc_class_of[(MAX(size, 1) + 15) / 16]]);
 }
 
+void kfree(void* p){
+    // objects in a slab are never page aligned
+    if(IS_PAGE_ADDR((u64)p)){
+        kfree_pages(p);
+        return;
+    }
+    kmem_cache_free(((struct slab*)PAGE_BASE((u64)p))->cache, p);
+}
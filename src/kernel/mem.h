@@ -13,6 +13,26 @@
 extern char end[];
 struct page {
     RefCount ref;
+    // buddy allocator, for the first page of a block
+    u8 order;
+    bool free;
+};
+
+// largest block of the buddy allocator is 2^BUDDY_MAX_ORDER pages
+#define BUDDY_MAX_ORDER 10
+
+struct buddystat {
+    u64 free_pages;
+    int largest_order;              // of the free blocks, -1 if none
+    u64 nr_free[BUDDY_MAX_ORDER + 1];   // free blocks of each order
+    u64 unusable[BUDDY_MAX_ORDER + 1];  // permille of free pages in smaller blocks
+};
+
+struct zero_pool_stat {
+    u64 pooled;     // pages in the pool now
+    u64 refills;    // pages ever zeroed into the pool
+    u64 hits;       // kalloc_page_zeroed() served by the pool
+    u64 misses;
 };
 
 u64 left_page_cnt();
@@ -21,8 +41,43 @@ WARN_RESULT void *get_zero_page();
 
 WARN_RESULT void *kalloc_page();
 void kfree_page(void *);
+// a cleared page, from the pool of pages zeroed by idle cpus if possible
+WARN_RESULT void *kalloc_page_zeroed();
+// zero a batch of pages into the pool, false if there is nothing to do
+bool zero_pool_refill();
+void get_zero_pool_stat(struct zero_pool_stat *);
+// 2^order physically contiguous pages
+WARN_RESULT void *kalloc_pages(int order);
+void kfree_pages(void *);
+// turn a block from kalloc_pages() with a single reference into pages which
+// are freed one by one with kfree_page()
+void split_pages(void *);
+void get_buddystat(struct buddystat *);
 void kshare_page(u64);
 usize get_page_ref(u64);
 
 WARN_RESULT void *kalloc(isize);
-void kfree(void *);
\ No newline at end of file
+void kfree(void *);
+
+// typed object caches, objects are at most a page minus the slab header
+// `ctor` is run when an object moves from its slab to a cpu cache, objects
+// should be freed in their constructed state so that they can be reused
+// from the cpu cache directly
+#define KMEM_CACHE_NAME_LEN 16
+#define KMEM_CACHE_CPU_SIZE 16
+#define KMEM_CACHE_CPU_BATCH 8
+
+struct kmem_cache;
+struct kmem_cache_stat {
+    char name[KMEM_CACHE_NAME_LEN];
+    u64 size;
+    u64 slabs;
+    u64 inuse;      // objects allocated and not freed
+    u64 allocs;
+    u64 hits;       // allocations served by the cpu cache
+};
+
+struct kmem_cache *kmem_cache_create(const char *name, usize size, void (*ctor)(void *));
+WARN_RESULT void *kmem_cache_alloc(struct kmem_cache *);
+void kmem_cache_free(struct kmem_cache *, void *);
+int get_kmem_cache_stats(struct kmem_cache_stat *, int n);
\ No newline at end of file
@@ -13,64 +13,252 @@
 #include <kernel/proc.h>
 #include <kernel/pt.h>
 #include <kernel/sched.h>
+#include <kernel/swap.h>
+#include <kernel/tlb.h>
 
 
 define_rest_init(paging) {
     // TODO
 }
 
-void init_sections(ListNode *section_head) {
+struct kmem_cache* section_cache;
+bool huge_pages = true;
+
+define_early_init(section_cache)
+{
+    section_cache = kmem_cache_create("section", sizeof(struct section), NULL);
+}
+
+void init_sections(struct pgdir* pd) {
     // TODO
-    struct section* heap = (struct section*)kalloc(sizeof(struct section));
+    struct section* heap = (struct section*)kmem_cache_alloc(section_cache);
     memset(heap, 0, sizeof(struct section));
     heap->begin = heap->end = 0;
     heap->flags = ST_HEAP;
-    _insert_into_list(section_head, &heap->stnode);
+    section_insert(pd, heap);
+}
+
+// Sections are indexed by an interval tree: a red-black tree ordered by
+// begin in which every node records the largest end in its subtree, so
+// that a search for an address or a range can skip the subtrees which end
+// before it. Page faults and user pointer checks often hit the same
+// section again, which is remembered in pd->last_section.
+
+#define rb_section(node) container_of(node, struct section, rbnode)
+
+static u64 _max_end(rb_node node) {
+    return node ? rb_section(node)->max_end : 0;
+}
+
+static void _section_compute(rb_node node) {
+    auto sec = rb_section(node);
+    sec->max_end = MAX(sec->end, MAX(_max_end(node->rb_left), _max_end(node->rb_right)));
+}
+
+static void _section_propagate(rb_node node, rb_node stop) {
+    for(; node != stop; node = _rb_parent(node))
+        _section_compute(node);
+}
+
+static void _section_copy(rb_node old, rb_node new) {
+    rb_section(new)->max_end = rb_section(old)->max_end;
+}
+
+static void _section_rotate(rb_node old, rb_node new) {
+    rb_section(new)->max_end = rb_section(old)->max_end;
+    _section_compute(old);
+}
+
+static const struct rb_augment section_augment = {
+    .propagate = _section_propagate,
+    .copy = _section_copy,
+    .rotate = _section_rotate,
+};
+
+static bool _section_cmp(rb_node lnode, rb_node rnode) {
+    auto l = rb_section(lnode);
+    auto r = rb_section(rnode);
+    // empty sections may share their begin with another one
+    return l->begin < r->begin || (l->begin == r->begin && l < r);
+}
+
+void section_insert(struct pgdir* pd, struct section* sec) {
+    _insert_into_list(&pd->section_head, &sec->stnode);
+    ASSERT(_rb_insert_augmented(&sec->rbnode, &pd->section_tree, _section_cmp, &section_augment) == 0);
+    if(sec->flags == ST_HEAP)pd->heap = sec;
+}
+
+void section_remove(struct pgdir* pd, struct section* sec) {
+    _detach_from_list(&sec->stnode);
+    _rb_erase_augmented(&sec->rbnode, &pd->section_tree, &section_augment);
+    if(pd->last_section == sec)pd->last_section = NULL;
+    if(pd->heap == sec)pd->heap = NULL;
+}
+
+void section_resize(struct pgdir* pd, struct section* sec, u64 begin, u64 end) {
+    if(begin != sec->begin){
+        _rb_erase_augmented(&sec->rbnode, &pd->section_tree, &section_augment);
+        sec->begin = begin;
+        sec->end = end;
+        ASSERT(_rb_insert_augmented(&sec->rbnode, &pd->section_tree, _section_cmp, &section_augment) == 0);
+    }
+    else{
+        sec->end = end;
+        _section_propagate(&sec->rbnode, NULL);
+    }
 }
 
-void free_section_pages(struct pgdir* pd, struct section* sec){
-    for(auto i = PAGE_BASE(sec->begin); i < sec->end; i+= PAGE_SIZE){
-        auto pte = get_pte(pd, i, false);
-        if(pte && (*pte & PTE_VALID)){
-            if((sec->flags == ST_MMAP_PRIVATE || sec->flags == ST_MMAP_SHARED) 
-                && !(*pte & PTE_RO) && get_page_ref(P2K(PTE_ADDRESS(*pte))) == 1){
-                if(sec->fp->type == FD_INODE){
-                    u64 this_begin = MAX(i, sec->begin);
-                    u64 this_end = MIN(i + PAGE_SIZE, sec->end);
-                    sec->fp->off = sec->offset + this_begin - sec->begin;
-                    file_write(sec->fp, (char*)P2K(PTE_ADDRESS(*pte)), this_end - this_begin);
-                }
-                else if(sec->fp->type == FD_PIPE){
-                    // TODO
-                    PANIC();
-                }
-                else PANIC();
+struct section* section_find(struct pgdir* pd, u64 addr) {
+    auto sec = pd->last_section;
+    if(sec && sec->begin <= addr && addr < sec->end)return sec;
+    sec = section_overlap(pd, addr, addr + 1);
+    if(sec)pd->last_section = sec;
+    return sec;
+}
+
+struct section* section_overlap(struct pgdir* pd, u64 begin, u64 end) {
+    // if the left subtree reaches past begin but has no overlap, every
+    // section in it begins at or after end, and so does every one to the right
+    rb_node node = pd->section_tree.rb_node;
+    while(node){
+        auto sec = rb_section(node);
+        if(sec->begin < end && begin < sec->end)return sec;
+        if(node->rb_left && _max_end(node->rb_left) > begin)node = node->rb_left;
+        else node = node->rb_right;
+    }
+    return NULL;
+}
+
+struct section* section_next(struct section* sec) {
+    rb_node node = _rb_next(&sec->rbnode);
+    return node ? rb_section(node) : NULL;
+}
+
+struct free_range {
+    struct tlb_gather* tlb;
+    struct section* sec;
+    u64 begin, end;
+};
+
+static int _free_block(struct pt_walk* w, u64 va, PTEntriesPtr pmd){
+    struct free_range* f = w->arg;
+    if(va >= f->begin && va + HUGE_PAGE_SIZE <= f->end){
+        unmap_huge(f->tlb, va);
+        return 0;
+    }
+    // the walk goes on into the pages of the split block. without memory
+    // to copy a shared block, it stays mapped until the page table is freed
+    if(!split_huge(w->pd, va))
+        ASSERT(IS_BLOCK_PTE(*pmd));
+    return 0;
+}
+
+// a shared table is dropped if all of it is freed, else this page table
+// gets its own copy
+static int _free_table(struct pt_walk* w, u64 va, PTEntriesPtr pmd){
+    struct free_range* f = w->arg;
+    if(!IS_SHARED_TABLE(*pmd))return 0;
+    if(f->tlb->fullmm || (va >= f->begin && va + HUGE_PAGE_SIZE <= f->end)){
+        if(!drop_table(f->tlb, va))
+            ASSERT(!IS_SHARED_TABLE(*pmd));
+    }
+    // without memory it stays mapped until the page table is freed
+    else if(!unshare_table(w->pd, va))
+        ASSERT(IS_SHARED_TABLE(*pmd));
+    return 0;
+}
+
+static int _free_pte(struct pt_walk* w, u64 va, PTEntriesPtr pte){
+    struct free_range* f = w->arg;
+    auto sec = f->sec;
+    if(*pte & PTE_VALID){
+        // a shared mapping only becomes writable on a write fault, so a
+        // writable page is dirty. private copies are never written back
+        if(sec->flags == ST_MMAP_SHARED && !(*pte & PTE_RO)){
+            if(sec->fp->type == FD_INODE){
+                u64 size = sec->fp->ip->entry.num_bytes;
+                u64 this_begin = MAX(va, f->begin);
+                u64 this_end = MIN(va + PAGE_SIZE, f->end);
+                u64 off = sec->offset + this_begin - sec->begin;
+                // do not grow the file
+                if(off + (this_end - this_begin) > size)
+                    this_end = off < size ? this_begin + (size - off) : this_begin;
+                sec->fp->off = off;
+                if(this_end > this_begin)
+                    file_write(sec->fp, (char*)P2K(PTE_ADDRESS(*pte)) + VA_OFFSET(this_begin), this_end - this_begin);
+            }
+            else if(sec->fp->type == FD_PIPE){
+                // TODO
+                PANIC();
             }
-            kfree_page((void*)P2K(PTE_ADDRESS(*pte)));
-            *pte = NULL;
+            else PANIC();
         }
+        void* page = (void*)P2K(PTE_ADDRESS(*pte));
+        *pte = NULL;
+        tlb_gather_page(f->tlb, va, page);
     }
+    else if(IS_SWAP_PTE(*pte)){
+        swap_free(*pte);
+        *pte = NULL;
+    }
+    return 0;
+}
+
+void free_section_range(struct tlb_gather* tlb, struct section* sec, u64 begin, u64 end){
+    struct free_range f = {tlb, sec, begin, end};
+    struct pt_walk w = {tlb->pd, false, _free_block, _free_table, _free_pte, &f};
+    walk_range(&w, begin, end);
+}
+
+void free_section_pages(struct tlb_gather* tlb, struct section* sec){
+    free_section_range(tlb, sec, sec->begin, sec->end);
 }
 
 void free_sections(struct pgdir *pd) {
     // TODO
     setup_checker(0);
     acquire_spinlock(0, &pd->lock);
+    // only called by free_pgdir, which gives up the ASID
+    struct tlb_gather tlb;
+    tlb_gather_init(&tlb, pd, true);
     auto p = pd->section_head.next;
     while(p){
         if(p != &pd->section_head){
             auto sec = container_of(p, struct section, stnode);
-            free_section_pages(pd, sec);
+            free_section_pages(&tlb, sec);
             p = p->next;
             _detach_from_list(&sec->stnode);
             if(sec->fp)file_close(sec->fp);
-            kfree(sec);
+            kmem_cache_free(section_cache, sec);
         }
         else break;
     }
+    tlb_gather_finish(&tlb);
+    pd->section_tree.rb_node = NULL;
+    pd->last_section = pd->heap = NULL;
     release_spinlock(0, &pd->lock);
 }
 
+void move_pgdir(struct pgdir* to, struct pgdir* from) {
+    // keep the locks in place, kswapd may hold them
+    _acquire_spinlock(&from->lock);
+    _acquire_spinlock(&to->lock);
+    ASSERT(to->pt == NULL && _empty_list(&to->section_head));
+    to->pt = from->pt;
+    _insert_into_list(&from->section_head, &to->section_head);
+    _detach_from_list(&from->section_head);
+    to->section_tree = from->section_tree;
+    to->heap = from->heap;
+    to->last_section = NULL;
+    to->asid = from->asid;
+    from->pt = NULL;
+    from->section_tree.rb_node = NULL;
+    from->heap = from->last_section = NULL;
+    from->asid = 0;
+    _release_spinlock(&to->lock);
+    _release_spinlock(&from->lock);
+}
+
 u64 sbrk(i64 size) {
     // TODO:
     // Increase the heap size of current process by `size`
@@ -82,37 +270,22 @@ u64 sbrk(i64 size) {
 
     auto this = thisproc();
     auto pd = &this->pgdir;
-    u64 ret = 0;
-    bool heap_exist = false;
     setup_checker(0);
     acquire_spinlock(0, &pd->lock);
-    _for_in_list(p, &pd->section_head){
-        if(p == &pd->section_head)continue;
-        auto sec = container_of(p, struct section, stnode);
-        if(sec->flags == ST_HEAP){
-            heap_exist = true;
-            if(size == 0){
-                release_spinlock(0, &pd->lock);
-                return sec->end;
-            }
-            ret = sec->end;
-            sec->end += size;
-            if(size > 0)ASSERT(sec->end > ret);
-            else if(sec->end > ret)sec->end = 0;
-
-            for(auto i = sec->end; i < ret; i += PAGE_SIZE){
-                auto pte = get_pte(pd, i, false);
-                if(pte && *pte & PTE_VALID){
-                    kfree_page((void*)P2K(PTE_ADDRESS(*pte)));
-                    *pte = 0;
-                }
-            }
-
-            break;
-        }
+    auto sec = pd->heap;
+    ASSERT(sec);
+    u64 ret = sec->end;
+    if(size != 0){
+        u64 end = sec->end + size;
+        if(size > 0)ASSERT(end > ret);
+        else if(end > ret)end = 0;
+        section_resize(pd, sec, sec->begin, end);
+        struct tlb_gather tlb;
+        tlb_gather_init(&tlb, pd, false);
+        free_section_range(&tlb, sec, sec->end, ret);
+        tlb_gather_finish(&tlb);
     }
     release_spinlock(0, &pd->lock);
-    ASSERT(heap_exist);
     return ret;
 }
 
@@ -121,6 +294,9 @@ u64 sbrk(i64 size) {
 #define ISS_ACC_FAULT 0X8
 #define ISS_PERMI_FAULT 0Xc
 
+// file-backed mappings map the pages of the inode page cache: a shared
+// mapping maps them writable after a write fault, a private one copies the
+// page on a write fault
 int mmap_handler(struct section* sec, u64 iss, u64 addr){
     struct pgdir *pd = &thisproc()->pgdir;
     if((ISS_TYPE_MASK & iss) == ISS_PERMI_FAULT){
@@ -130,36 +306,98 @@ int mmap_handler(struct section* sec, u64 iss, u64 addr){
 
         if(!(sec->prot&PROT_WRITE)){
             // illegal
-            exit(-1);
+            return -1;
         }
-        else{
-            if(sec->flags == ST_MMAP_PRIVATE && get_file_ref(sec->fp) > 1){
-                // other process are using
-                // copy to new page
-                auto pg = kalloc_page();
-                memcpy(pg, (void*)P2K(PTE_ADDRESS(*pte)), PAGE_SIZE);
-                kfree_page((void*)P2K(PTE_ADDRESS(*pte)));
-                *pte = K2P(pg) | PTE_USER_DATA | PTE_RW;
-            }
-            else{
-                *pte = P2K(PTE_ADDRESS(*pte)) | PTE_USER_DATA | PTE_RW;
-            }
+        void* page = (void*)P2K(PTE_ADDRESS(*pte));
+        if(sec->flags == ST_MMAP_PRIVATE && get_page_ref((u64)page) > 1){
+            // shared with the page cache or another process, copy it
+            auto pg = kalloc_page();
+            if(!pg)return -1;
+            memcpy(pg, page, PAGE_SIZE);
+            kfree_page(page);
+            page = pg;
         }
+        *pte = K2P(page) | PTE_USER_DATA | PTE_RW;
     }
     else if(((ISS_TYPE_MASK & iss) == ISS_TRANS_FAULT)){
-        // file unload
-        auto this_begin = MAX(PAGE_BASE(addr), sec->begin);
-        auto this_end = MIN((PAGE_BASE(addr) + PAGE_SIZE), sec->end);
-        auto pg = kalloc_page();
-        memset(pg, 0, PAGE_SIZE);
-        sec->fp->off = sec->offset + this_begin - sec->begin;
-        file_read(sec->fp, (char*)pg, this_end - this_begin);
+        // map the page from the page cache, read only until written
+        if(sec->fp->type != FD_INODE || sec->fp->ip->entry.type == INODE_DEVICE)return -1;
+        usize index = (PAGE_BASE(addr) - sec->begin + sec->offset) / PAGE_SIZE;
+        auto ip = sec->fp->ip;
+        inodes.lock(ip);
+        void* pg = inodes.get_page(ip, index);
+        inodes.unlock(ip);
+        if(!pg)return -1;
         auto pte = get_pte(pd, addr, true);
+        if(!pte){
+            kfree_page(pg);
+            return -1;
+        }
         *pte = K2P(pg) | PTE_USER_DATA | PTE_RO;
     }
     else{
-        exit(-1);
+        return -1;
+    }
+    return 0;
+}
+
+// read the part of the text section `w->arg` in the page of `va`, the file
+// is read in order
+static int _load_text_pte(struct pt_walk* w, u64 va, PTEntriesPtr pte){
+    struct section* sec = w->arg;
+    if(!(*pte & PTE_VALID)){
+        void* p = kalloc_page();
+        if(!p)return -1;
+        *pte = K2P(p) | PTE_USER_DATA | PTE_RO;
     }
+    u64 begin = MAX(va, sec->begin);
+    u64 end = MIN(va + PAGE_SIZE, sec->begin + sec->length);
+    if(file_read(sec->fp, (char*)(P2K(PTE_ADDRESS(*pte)) + VA_OFFSET(begin)), end - begin) != (isize)(end - begin))PANIC();
+    return 0;
+}
+
+// map the page of the data section `sec` at `addr`, read only until written
+// like a private mapping: a page of the file from the page cache, the shared
+// zero page past the end of the file and a copy for the page the file ends
+// in, whose rest is bss. pd->lock is held, and dropped while the inode is
+// locked and read, like in swap_in()
+static int _load_data_page(struct pgdir* pd, struct section* sec, u64 addr){
+    u64 va = PAGE_BASE(addr), file_end = sec->begin + sec->length;
+    void* pg = get_zero_page();
+    u64 flags = PTE_USER_DATA | PTE_RO;
+    if(va < file_end){
+        // page aligned, checked by execve
+        usize index = (sec->offset + va - sec->begin) / PAGE_SIZE;
+        // only the process changes its sections, sec stays
+        auto ip = sec->fp->ip;
+        _release_spinlock(&pd->lock);
+        inodes.lock(ip);
+        pg = inodes.get_page(ip, index);
+        inodes.unlock(ip);
+        if(pg && va + PAGE_SIZE > file_end){
+            void* copy = kalloc_page();
+            if(copy){
+                memcpy(copy, pg, file_end - va);
+                memset(copy + (file_end - va), 0, PAGE_SIZE - (file_end - va));
+            }
+            kfree_page(pg);
+            pg = copy;
+            flags = PTE_USER_DATA | PTE_RW;
+        }
+        _acquire_spinlock(&pd->lock);
+        if(!pg)return -1;
+    }
+    auto pte = get_pte(pd, va, true);
+    if(!pte){
+        kfree_page(pg);
+        return -1;
+    }
+    // mapped meanwhile
+    if(*pte & PTE_VALID){
+        kfree_page(pg);
+        return 0;
+    }
+    *pte = K2P(pg) | flags;
     return 0;
 }
 
@@ -173,22 +411,54 @@ int pgfault_handler(u64 iss) {
     // 2. Check section flags to determine page fault type
     // 3. Handle the page fault accordingly
     // 4. Return to user code or kill the process
-    struct section* sec = NULL;
+    swap_wait_pages();
     setup_checker(0);
     acquire_spinlock(0, &pd->lock);
-    _for_in_list(valptr, &pd->section_head){
-        if(valptr == &pd->section_head){
-            sec = NULL;
-            continue;
-        }
-        sec = container_of(valptr, struct section, stnode);
-        if(sec->begin <= addr && addr < sec->end)break;
+    struct section* sec = section_find(pd, addr);
+    if(!sec && addr < TOP_USER_STACK){
+        // e.g. the stack grown past USER_STACK_SIZE
+        release_spinlock(0, &pd->lock);
+        printk("(Error): page fault at %llx outside any section\n", addr);
+        exit(-1);
     }
     ASSERT(sec);
 
+    auto pmd = get_pmd(pd, addr, false);
+    if(pmd && IS_BLOCK_PTE(*pmd)){
+        // only a write to a block shared by fork faults
+        ASSERT((ISS_TYPE_MASK & iss) == ISS_PERMI_FAULT);
+        bool ok = cow_huge(pd, addr);
+        release_spinlock(0, &pd->lock);
+        if(!ok)exit(-1);
+        return 0;
+    }
+    // the first fault in a 2 MB whose page table is shared since fork
+    if(pmd && IS_SHARED_TABLE(*pmd) && !unshare_table(pd, addr)){
+        release_spinlock(0, &pd->lock);
+        exit(-1);
+    }
+    auto pte = get_pte(pd, addr, false);
+    if(pte && IS_SWAP_PTE(*pte)){
+        bool ok = swap_in(pd, addr);
+        release_spinlock(0, &pd->lock);
+        if(!ok)exit(-1);
+        flush_tlb_page(pd, addr);
+        return 0;
+    }
+    if((ISS_TYPE_MASK & iss) == ISS_ACC_FAULT){
+        // the access flag was cleared by kswapd
+        ASSERT(pte && (*pte & PTE_VALID));
+        *pte |= AF_USED;
+        release_spinlock(0, &pd->lock);
+        flush_tlb_page(pd, addr);
+        return 0;
+    }
+
     if(sec->flags == ST_MMAP_PRIVATE || sec->flags ==ST_MMAP_SHARED){
         int ret =  mmap_handler(sec, iss, addr);
         release_spinlock(0, &pd->lock);
+        if(ret < 0)exit(-1);
+        flush_tlb_page(pd, addr);
         return ret;
     }
     
@@ -196,12 +466,24 @@ int pgfault_handler(u64 iss) {
         // Copy on Write
         // if(sec->flags == ST_HEAP || sec->flags == ST_DATA){
         ASSERT(sec->flags != ST_TEXT);
-        auto pg = kalloc_page();
         auto pte = get_pte(pd, addr, false);
         ASSERT(pte);
-        memcpy(pg, (void*)P2K(PTE_ADDRESS(*pte)), PAGE_SIZE);
-        kfree_page((void*)P2K(PTE_ADDRESS(*pte)));  // unshare the previously shared page
-        vmmap(pd, addr, pg, PTE_USER_DATA | PTE_RW);
+        void* old = (void*)P2K(PTE_ADDRESS(*pte));
+        // the zero page is never taken over, its count is not kept
+        if(old != get_zero_page() && get_page_ref((u64)old) == 1){
+            // no longer shared, e.g. copied by a block split
+            *pte &= ~(u64)PTE_RO;
+        }
+        else{
+            auto pg = kalloc_page();
+            if(!pg){
+                release_spinlock(0, &pd->lock);
+                exit(-1);
+            }
+            memcpy(pg, old, PAGE_SIZE);
+            kfree_page(old);  // unshare the previously shared page
+            vmmap(pd, addr, pg, PTE_USER_DATA | PTE_RW);
+        }
         // }
         // else if(sec->flags == ST_USER_STACK || sec->flags == ST_TEXT){
         //     // this only happens in a forked children processp
@@ -211,8 +493,20 @@ int pgfault_handler(u64 iss) {
     }
     else if(((ISS_TYPE_MASK & iss) == ISS_TRANS_FAULT)){
         //Lazy Allocation
-        if(sec->flags == ST_HEAP){
-            void* p = kalloc_page();
+        if(sec->flags == ST_HEAP || sec->flags == ST_USER_STACK){
+            // a 2 MB block if the heap covers all of it
+            u64 base = HUGE_BASE(addr);
+            if(sec->flags == ST_HEAP && huge_pages && base >= sec->begin
+                && base + HUGE_PAGE_SIZE <= sec->end
+                && alloc_huge(pd, base, PTE_USER_BLOCK | PTE_RW)){
+                release_spinlock(0, &pd->lock);
+                return 0;
+            }
+            void* p = kalloc_page_zeroed();
+            if(!p){
+                release_spinlock(0, &pd->lock);
+                exit(-1);
+            }
             vmmap(pd, addr, p, PTE_USER_DATA | PTE_RW);
         }
         else if(sec->flags == ST_TEXT){
@@ -220,59 +514,44 @@ int pgfault_handler(u64 iss) {
                 printk("(Error): text section with length 0");
                 exit(-1);
             }
-            usize len = sec->length;
-            u64 va = sec->begin;
             sec->fp->off = sec->offset;
-            while(len){
-                usize cur_len = MIN(len, PAGE_SIZE - VA_OFFSET(va));
-                auto pte = get_pte(pd, va, true);
-                if(!(*pte & PTE_VALID)){
-                    void* p = kalloc_page();
-                    vmmap(pd, va, p, PTE_USER_DATA | PTE_RO);
-                }
-                if(file_read(sec->fp, (char*)(P2K(PTE_ADDRESS(*pte)) + VA_OFFSET(va)), cur_len) != (isize)cur_len)PANIC();
-                len -= cur_len;
-                va += cur_len;
+            struct pt_walk w = {pd, true, NULL, NULL, _load_text_pte, sec};
+            if(walk_range(&w, sec->begin, sec->begin + sec->length) < 0){
+                release_spinlock(0, &pd->lock);
+                exit(-1);
             }
             sec->length = 0;
             file_close(sec->fp);
             sec->fp = 0;
         }
         else if(sec->flags == ST_DATA){
-            // data and bss section
-            // not use lazy allocation
-            printk("(Error): did not apply lazy allocation on data and bss section");
-            exit(-1);
-        }
-        else if(sec->flags == ST_USER_STACK){
-            printk("(Error): did not apply lazy allocation on user stack");
-            exit(-1);
+            if(_load_data_page(pd, sec, addr) < 0){
+                release_spinlock(0, &pd->lock);
+                exit(-1);
+            }
         }
         
     }
-    else if((ISS_TYPE_MASK & iss) == ISS_ACC_FAULT){
-        PANIC();
-    }
     else{
         printk("unknown\n");
         exit(-1);
     }
     release_spinlock(0, &pd->lock);
-    arch_tlbi_vmalle1is();
+    flush_tlb_page(pd, addr);
     return 0;
 }
 
-void copy_sections(ListNode* from_head, ListNode* to_head){
-	_for_in_list(node, from_head){
-		if(node == from_head){
+void copy_sections(struct pgdir* from, struct pgdir* to){
+	_for_in_list(node, &from->section_head){
+		if(node == &from->section_head){
 			break;
 		}
 		struct section* st = container_of(node, struct section, stnode);
-		struct section* new_st = kalloc(sizeof(struct section));
+		struct section* new_st = kmem_cache_alloc(section_cache);
 		memmove(new_st, st, sizeof(struct section));
 		if(st->fp != NULL){
 			new_st->fp = file_dup(st->fp);
 		}
-		_insert_into_list(to_head, &(new_st->stnode));
+		section_insert(to, new_st);
 	}
 }
\ No newline at end of file
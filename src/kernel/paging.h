@@ -1,6 +1,7 @@
 #pragma once
 
 #include <aarch64/mmu.h>
+#include <common/rbtree.h>
 #include <kernel/proc.h>
 
 #define ST_FILE 1
@@ -27,6 +28,9 @@ struct section {
     u64 begin;
     u64 end;
     ListNode stnode;
+    // in pgdir.section_tree, max_end is the largest end in the subtree
+    struct rb_node_ rbnode;
+    u64 max_end;
     // These are for file-backed sections
     struct file *fp; // pointer to file struct
     u64 offset;      // the offset in file
@@ -35,9 +39,31 @@ struct section {
     u64 prot;
 };
 
+extern struct kmem_cache *section_cache;
+// map 2 MB aligned ranges of the heap with blocks on page faults
+extern bool huge_pages;
+
 int pgfault_handler(u64 iss);
-void init_sections(ListNode *section_head);
-void free_section_pages(struct pgdir*, struct section*);
+void init_sections(struct pgdir *pd);
+// add `sec` to the list and the tree of `pd`
+void section_insert(struct pgdir *pd, struct section *sec);
+void section_remove(struct pgdir *pd, struct section *sec);
+// change the bounds of `sec`, which is in `pd`
+void section_resize(struct pgdir *pd, struct section *sec, u64 begin, u64 end);
+// the section containing `addr`, or NULL
+struct section *section_find(struct pgdir *pd, u64 addr);
+// a section overlapping [begin, end), or NULL
+struct section *section_overlap(struct pgdir *pd, u64 begin, u64 end);
+// the section following `sec` in address order, or NULL
+struct section *section_next(struct section *sec);
+struct tlb_gather;
+void free_section_pages(struct tlb_gather *, struct section *);
+// free the pages of `sec` in [begin, end) of tlb->pd, writing dirty shared
+// mappings back. The flush and the freeing wait for tlb_gather_finish()
+void free_section_range(struct tlb_gather *, struct section *, u64 begin, u64 end);
 void free_sections(struct pgdir *pd);
-void copy_sections(ListNode *from_head, ListNode *to_head);
+// move the page table and the sections of `from` to `to`, which has none
+// after free_pgdir(), and leave `from` without any
+void move_pgdir(struct pgdir *to, struct pgdir *from);
+void copy_sections(struct pgdir *from, struct pgdir *to);
 u64 sbrk(i64 size);
\ No newline at end of file
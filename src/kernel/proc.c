@@ -6,6 +6,9 @@
 #include <kernel/proc.h>
 #include <kernel/sched.h>
 #include <kernel/paging.h>
+#include <aarch64/fpsimd.h>
+#include <kernel/swap.h>
+#include <kernel/tlb.h>
 
 #define NPAGE_FORPID 1
 
@@ -51,6 +54,13 @@ bool _free_pid(int pid){
     return true;
 }
 
+struct kmem_cache* proc_cache;
+
+define_early_init(proc_cache)
+{
+    proc_cache = kmem_cache_create("proc", sizeof(struct proc), NULL);
+}
+
 define_early_init(plock)
 {
     init_spinlock(&plock);
@@ -89,7 +99,8 @@ NO_RETURN void exit(int code) {
         if(notify)post_sem(&root_proc.childexit);
     }
     _release_spinlock(&plock);
-    free_pgdir(&this->pgdir);
+    put_pgdir(this);
+    fpsimd_release();
     _decrement_rc(&this->cwd->rc);
     kfree_page(this->kstack);
 
@@ -128,7 +139,7 @@ int wait(int *exitcode) {
                 *exitcode = child->exitcode;
                 id = child->pid;
                 _detach_from_list(p);
-                kfree(child);
+                kmem_cache_free(proc_cache, child);
                 _release_spinlock(&plock);
                 _free_pid(id);      // free pid here
                 _acquire_spinlock(&plock);
@@ -160,6 +171,28 @@ struct proc* _find_by_pid(struct proc* root, int pid){
     return ret;
 }
 
+static struct proc* _next_proc(struct proc* root, int pid){
+    struct proc* ret = root->pid > pid && !is_unused(root) ? root : NULL;
+    _for_in_list(p, &root->children){
+        if(p == &root->children)continue;
+        auto q = _next_proc(container_of(p, struct proc, ptnode), pid);
+        if(q && (!ret || q->pid < ret->pid))ret = q;
+    }
+    return ret;
+}
+
+int with_next_proc(int pid, void (*fn)(struct proc*, void*), void* arg){
+    int ret = -1;
+    _acquire_spinlock(&plock);
+    auto p = _next_proc(&root_proc, pid);
+    if(p){
+        fn(p, arg);
+        ret = p->pid;
+    }
+    _release_spinlock(&plock);
+    return ret;
+}
+
 int kill(int pid) {
     // TODO
     // Set the killed flag of the proc to true and return 0.
@@ -206,10 +239,12 @@ void init_proc(struct proc *p) {
     _acquire_spinlock(&plock);
     p->pid = pid;
     init_sem(&p->childexit, 0);
+    init_sem(&p->vfork_done, 0);
     init_list_node(&p->children);
     init_list_node(&p->ptnode);
     init_pgdir(&p->pgdir);
     p->kstack = kalloc_page();
+    p->fpsimd_cpu = -1;
     init_schinfo(&p->schinfo);
     p->kcontext = (KernelContext*)((u64)p->kstack + PAGE_SIZE - 16 - sizeof(KernelContext) - sizeof(UserContext));
     p->ucontext = (UserContext*)((u64)p->kstack + PAGE_SIZE - 16 - sizeof(UserContext));
@@ -218,7 +253,7 @@ void init_proc(struct proc *p) {
 }
 
 struct proc *create_proc() {
-    struct proc *p = kalloc(sizeof(struct proc));
+    struct proc *p = kmem_cache_alloc(proc_cache);
     init_proc(p);
     return p;
 }
@@ -235,10 +270,62 @@ define_init(root_proc) {
  */
 void trap_return();
 struct proc* sh;  // for debugging
+
+void copy_files(struct proc* p, struct proc* child){
+    memset((void*)&child->oftable, 0, sizeof(struct oftable));
+    if(child->cwd != p->cwd){
+        OpContext ctx;
+        bcache.begin_op(&ctx);
+        inodes.put(&ctx, child->cwd);
+        bcache.end_op(&ctx);
+        child->cwd = inodes.share(p->cwd);
+    }
+
+    for(auto i = 0; i < NOFILE; i++){
+        if(p->oftable.files[i] && p->oftable.files[i]->type != FD_SOCKET){
+            child->oftable.files[i] = file_dup(p->oftable.files[i]);
+        }
+        else break;
+    }
+}
+
+struct fork_copy {
+    struct pgdir* child;
+    struct tlb_gather* tlb;
+};
+
+// share the whole block, copied on write like a page
+static int _fork_block(struct pt_walk* w, u64 va, PTEntriesPtr pmd){
+    struct fork_copy* c = w->arg;
+    if(!(*pmd & PTE_RO))tlb_gather_va(c->tlb, va);
+    *pmd |= PTE_RO;
+    kshare_page(P2K(PTE_ADDRESS(*pmd)));
+    vmmap_huge(c->child, va, (void*)P2K(PTE_ADDRESS(*pmd)), PTE_FLAGS(*pmd));
+    return 0;
+}
+
+// share the page table of the 2 MB, copied by the first fault which
+// changes it in either process
+static int _fork_table(struct pt_walk* w, u64 va, PTEntriesPtr pmd){
+    struct fork_copy* c = w->arg;
+    auto child = get_pmd(c->child, va, true);
+    // shared already for another section in the 2 MB
+    if(*child)return 0;
+    if(!(*pmd & PTE_TABLE_RO)){
+        // all translations of the 2 MB become read only
+        *pmd |= PTE_TABLE_RO;
+        tlb_gather_all(c->tlb);
+    }
+    kshare_page(P2K(PTE_ADDRESS(*pmd)));
+    *child = *pmd;
+    return 0;
+}
+
 int fork() { /* TODO: Your code here. */
     auto this = thisproc();
     auto new = create_proc();
     if(!sh)sh = new;
+    new->schinfo.nice = this->schinfo.nice;
 
     _acquire_spinlock(&plock);
     new->parent = this;
@@ -247,12 +334,18 @@ int fork() { /* TODO: Your code here. */
 
     memcpy((void*)new->ucontext, (void*)this->ucontext, sizeof(UserContext));
     new->ucontext->x[0] = 0;
+    if(fpsimd_fork(new) != 0)ASSERT(kill(new->pid) != -1);
 
     _acquire_spinlock(&this->pgdir.lock);
+    // the pages of the parent become read only
+    struct tlb_gather tlb;
+    tlb_gather_init(&tlb, &this->pgdir, false);
+    struct fork_copy copy = {&new->pgdir, &tlb};
+    struct pt_walk w = {&this->pgdir, false, _fork_block, _fork_table, NULL, &copy};
     _for_in_list(p, &this->pgdir.section_head){
         if(p != &this->pgdir.section_head){
             auto st = container_of(p, struct section, stnode);
-            auto new_st = (struct section*)kalloc(sizeof(struct section));
+            auto new_st = (struct section*)kmem_cache_alloc(section_cache);
             memset(new_st, 0, sizeof(struct section));
             if(new_st == NULL){
                 ASSERT(kill(new->pid) != -1);
@@ -261,45 +354,57 @@ int fork() { /* TODO: Your code here. */
             new_st->begin = st->begin;
             new_st->end = st->end;
             new_st->flags = st->flags;
+            new_st->prot = st->prot;
             if(st->fp){
                 new_st->fp = file_dup(st->fp);
                 new_st->offset = st->offset;
                 new_st->length = st->length;
             }
-            _insert_into_list(new->pgdir.section_head.prev, &new_st->stnode);
-
-            for(auto va = PAGE_BASE(st->begin); va < st->end; va += PAGE_SIZE){
-                auto pte = get_pte(&this->pgdir, va, false);
-                if(pte && (*pte & PTE_VALID)){
-                    *pte |= PTE_RO;
-                    vmmap(&new->pgdir, va, (void*)P2K(PTE_ADDRESS(*pte)), PTE_FLAGS(*pte));
-                    kshare_page(P2K(PTE_ADDRESS(*pte)));
-                    // copyout(&new->pgdir, (void*)va, (void*)P2K(PTE_ADDRESS(*pte)), PAGE_SIZE);
-                    // auto new_pte = get_pte(&new->pgdir, va, false);
-                    // *new_pte |= PTE_USER_DATA | PTE_RW;
-                }
-            }
+            section_insert(&new->pgdir, new_st);
+
+            walk_range(&w, st->begin, st->end);
         }
     }
+    tlb_gather_finish(&tlb);
     _release_spinlock(&this->pgdir.lock);
 
-    memset((void*)&new->oftable, 0, sizeof(struct oftable));
-    if(new->cwd != this->cwd){
-        OpContext ctx;
-        bcache.begin_op(&ctx);
-        inodes.put(&ctx, new->cwd);
-        bcache.end_op(&ctx);
-        new->cwd = inodes.share(this->cwd);
-    }
+    copy_files(this, new);
+    start_proc(new, trap_return, 0);
 
-    for(auto i = 0; i < NOFILE; i++){
-        if(this->oftable.files[i] && this->oftable.files[i]->type != FD_SOCKET){
-            new->oftable.files[i] = file_dup(this->oftable.files[i]);
-        }
-        else break;
+    return new->pid;
+}
+
+void put_pgdir(struct proc* p) {
+    auto parent = p->vfork_parent;
+    if(!parent){
+        free_pgdir(&p->pgdir);
+        return;
     }
+    // the parent does not run before it has its address space back
+    move_pgdir(&parent->pgdir, &p->pgdir);
+    p->vfork_parent = NULL;
+    post_sem(&parent->vfork_done);
+}
 
-    start_proc(new, trap_return, 0);
+/*
+ * Create a new process running in the address space of the caller, which
+ * is suspended until the child execs or exits.
+ */
+int vfork() {
+    auto this = thisproc();
+    auto new = create_proc();
+    new->schinfo.nice = this->schinfo.nice;
+    set_parent_to_this(new);
 
-    return new->pid;
-}
\ No newline at end of file
+    memcpy((void*)new->ucontext, (void*)this->ucontext, sizeof(UserContext));
+    new->ucontext->x[0] = 0;
+    if(fpsimd_fork(new) != 0)ASSERT(kill(new->pid) != -1);
+
+    free_pgdir(&new->pgdir);
+    move_pgdir(&new->pgdir, &this->pgdir);
+    new->vfork_parent = this;
+    copy_files(this, new);
+    int pid = start_proc(new, trap_return, 0);
+    unalertable_wait_sem(&this->vfork_done);
+    return pid;
+}
@@ -8,7 +8,8 @@
 #include <kernel/pt.h>
 #include <kernel/schinfo.h>
 
-#define USER_STACK_SIZE (PAGE_SIZE * 8)
+// the user stack grows on demand up to USER_STACK_SIZE
+#define USER_STACK_SIZE (8 * 1024 * 1024)
 #define TOP_USER_STACK 0x800000000000
 #define RESERVED_SIZE 512
 
@@ -16,7 +17,8 @@ enum procstate { UNUSED, RUNNABLE, RUNNING, SLEEPING, DEEPSLEEPING, ZOMBIE };
 
 typedef struct UserContext {
     // TODO: customize your trap frame
-    u64 res, q0_high, tpidr_el0, q0_low, spsr, elr, sp;
+    // fp/simd registers are switched lazily, see aarch64/fpsimd.c
+    u64 tpidr_el0, res, spsr, elr, sp;
     u64 x[31]; //x0-30
 } UserContext;
 
@@ -44,12 +46,41 @@ struct proc {
     KernelContext *kcontext;
     struct oftable oftable;
     Inode *cwd; // current working dictionary
+    struct fpsimd_state *fpsimd; // NULL until the first use of fp/simd
+    int fpsimd_cpu; // the cpu which loaded fpsimd last time
+    // a child of vfork() runs in the address space of vfork_parent, which
+    // waits on its vfork_done until the child execs or exits
+    struct proc *vfork_parent;
+    Semaphore vfork_done;
 };
 
 // void init_proc(struct proc*);
+extern struct kmem_cache *proc_cache;
+
 WARN_RESULT struct proc *create_proc();
 int start_proc(struct proc *, void (*entry)(u64), u64 arg);
 NO_RETURN void exit(int code);
 WARN_RESULT int wait(int *exitcode);
 WARN_RESULT int kill(int pid);
-WARN_RESULT int fork();
\ No newline at end of file
+// call fn on the process with the smallest pid above `pid`, with the process
+// tree locked so that it is not freed meanwhile; return its pid or -1
+int with_next_proc(int pid, void (*fn)(struct proc *, void *), void *arg);
+WARN_RESULT int fork();
+WARN_RESULT int vfork();
+// free the address space of p, or give it back if it is lent by vfork()
+void put_pgdir(struct proc *p);
+// the child of fork, vfork or spawn gets the open files and working
+// directory of p
+void copy_files(struct proc *p, struct proc *child);
+
+// file actions of spawn(), done in order on the open files of the child
+enum { SPAWN_CLOSE, SPAWN_DUP2 };
+struct spawn_action {
+    int type;
+    int fd;
+    int newfd;  // SPAWN_DUP2 makes newfd a copy of fd
+};
+// create a child running the program at `path` without copying the address
+// space of the caller, return its pid or -1
+int spawn(const char *path, char *const argv[], char *const envp[],
+          const struct spawn_action *actions, int nactions);
\ No newline at end of file
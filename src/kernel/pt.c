@@ -3,28 +3,25 @@
 #include <kernel/mem.h>
 #include <kernel/pt.h>
 #include <kernel/paging.h>
+#include <kernel/init.h>
 #include <kernel/printk.h>
+#include <kernel/swap.h>
+#include <kernel/tlb.h>
 
 static inline PTEntriesPtr alloc_pte(){
-    PTEntriesPtr pte = (PTEntriesPtr)kalloc_page();
+    PTEntriesPtr pte = (PTEntriesPtr)kalloc_page_zeroed();
     if(pte == NULL)PANIC();
-    memset(pte, NULL, PAGE_SIZE);
     return pte;
 }
 
 #define CHECK_VALID(pte) (((u64)pte & PTE_VALID) == 1)
-PTEntriesPtr get_pte(struct pgdir* pgdir, u64 va, bool alloc)
+PTEntriesPtr get_pmd(struct pgdir* pgdir, u64 va, bool alloc)
 {
-    // TODO
-    // Return a pointer to the PTE (Page Table Entry) for virtual address 'va'
-    // If the entry not exists (NEEDN'T BE VALID), allocate it if alloc=true, or return NULL if false.
-    // THIS ROUTINUE GETS THE PTE, NOT THE PAGE DESCRIBED BY PTE.
-
     if(pgdir->pt == NULL && alloc == false)return NULL;
-    u64 index[] = {VA_PART0(va), VA_PART1(va), VA_PART2(va)};
+    u64 index[] = {VA_PART0(va), VA_PART1(va)};
     if(pgdir->pt == NULL)pgdir->pt = alloc_pte();
     PTEntriesPtr curr = pgdir->pt;
-    for(int level = 0; level < 3; level++){
+    for(int level = 0; level < 2; level++){
         curr += index[level];
         if(*curr == NULL && alloc == false)return NULL;
         if(*curr == NULL){
@@ -33,7 +30,29 @@ PTEntriesPtr get_pte(struct pgdir* pgdir, u64 va, bool alloc)
         }
         curr = (PTEntriesPtr)P2K(PTE_ADDRESS(*curr));
     }
-    return curr + VA_PART3(va);
+    return curr + VA_PART2(va);
+}
+
+PTEntriesPtr get_pte(struct pgdir* pgdir, u64 va, bool alloc)
+{
+    // TODO
+    // Return a pointer to the PTE (Page Table Entry) for virtual address 'va'
+    // If the entry not exists (NEEDN'T BE VALID), allocate it if alloc=true, or return NULL if false.
+    // THIS ROUTINUE GETS THE PTE, NOT THE PAGE DESCRIBED BY PTE.
+
+    PTEntriesPtr pmd = get_pmd(pgdir, va, alloc);
+    if(pmd == NULL)return NULL;
+    if(*pmd == NULL && alloc == false)return NULL;
+    if(*pmd == NULL){
+        PTEntriesPtr new_entry = alloc_pte();
+        *pmd = K2P(new_entry) | PTE_TABLE;
+    }
+    // mapped by a 2 MB block, see split_huge
+    if(IS_BLOCK_PTE(*pmd)){
+        ASSERT(alloc == false);
+        return NULL;
+    }
+    return (PTEntriesPtr)P2K(PTE_ADDRESS(*pmd)) + VA_PART3(va);
 
     // if(!CHECK_VALID(pgdir->pt) && alloc == false)return NULL;
     // u64 index[] = {VA_PART0(va), VA_PART1(va), VA_PART2(va)};
@@ -55,12 +74,139 @@ PTEntriesPtr get_pte(struct pgdir* pgdir, u64 va, bool alloc)
     // return curr + VA_PART3(va);
 }
 
+// the entries of a table at `level` which cover [va, end)
+static int _walk(struct pt_walk* w, PTEntriesPtr table, int level, u64 va, u64 end)
+{
+    int shift = 39 - 9 * level;
+    u64 span = 1ull << shift;
+    for(; va < end; va = (va & ~(span - 1)) + span){
+        u64 base = va & ~(span - 1);
+        PTEntriesPtr entry = table + ((va >> shift) & (N_PTE_PER_TABLE - 1));
+        int ret;
+        if(level == 3){
+            if(*entry == NULL && !w->alloc)continue;
+            if(w->pte && (ret = w->pte(w, base, entry)))return ret;
+            continue;
+        }
+        if(level == 2 && IS_BLOCK_PTE(*entry)){
+            if(w->block && (ret = w->block(w, base, entry)))return ret;
+            // go on into the page table if the block has been split
+            if(IS_BLOCK_PTE(*entry))continue;
+        }
+        if(level == 2 && *entry){
+            if(w->table){
+                if((ret = w->table(w, base, entry)))return ret;
+            }
+            else if(w->alloc && IS_SHARED_TABLE(*entry) && !unshare_table(w->pd, base))
+                return -1;
+            if(IS_SHARED_TABLE(*entry))continue;
+        }
+        if(*entry == NULL){
+            if(!w->alloc)continue;
+            *entry = K2P(alloc_pte()) | PTE_TABLE;
+        }
+        u64 next = base + span;
+        if((ret = _walk(w, (PTEntriesPtr)P2K(PTE_ADDRESS(*entry)), level + 1, va, MIN(end, next))))
+            return ret;
+    }
+    return 0;
+}
+
+int walk_range(struct pt_walk* w, u64 begin, u64 end)
+{
+    if(w->pd->pt == NULL){
+        if(!w->alloc)return 0;
+        w->pd->pt = alloc_pte();
+    }
+    return _walk(w, w->pd->pt, 0, PAGE_BASE(begin), end);
+}
+
 void init_pgdir(struct pgdir *pgdir) { 
     pgdir->pt = alloc_pte();
     ASSERT(pgdir->pt);
     init_spinlock(&pgdir->lock);
     init_list_node(&pgdir->section_head);
-    init_sections(&pgdir->section_head);
+    pgdir->section_tree.rb_node = NULL;
+    pgdir->last_section = pgdir->heap = NULL;
+    pgdir->asid = 0;
+    init_sections(pgdir);
+}
+
+static u64 huge_live, huge_faults, huge_splits, huge_copies;
+// the references of shared tables are dropped with it held, so that the
+// last one is seen by its reference count
+static SpinLock table_lock;
+
+define_early_init(table_lock) {
+    init_spinlock(&table_lock);
+}
+
+bool unshare_table(struct pgdir* pd, u64 va)
+{
+    PTEntriesPtr pmd = get_pmd(pd, va, false);
+    ASSERT(pmd && IS_SHARED_TABLE(*pmd));
+    PTEntriesPtr table = (PTEntriesPtr)P2K(PTE_ADDRESS(*pmd));
+    _acquire_spinlock(&table_lock);
+    if(get_page_ref((u64)table) == 1){
+        // the other page tables have given it up
+        *pmd &= ~PTE_TABLE_RO;
+        _release_spinlock(&table_lock);
+        flush_tlb_pgdir(pd);
+        return true;
+    }
+    PTEntriesPtr copy = kalloc_page();
+    if(copy == NULL){
+        _release_spinlock(&table_lock);
+        return false;
+    }
+    for(int i = 0; i < N_PTE_PER_TABLE; i++){
+        PTEntry pte = table[i];
+        if(pte & PTE_VALID){
+            // the page is shared from now on, copied on write by whichever
+            // page table writes it first
+            pte |= PTE_RO;
+            table[i] = pte;
+            // kfree_page() ignores the zero page
+            if(P2K(PTE_ADDRESS(pte)) != (u64)get_zero_page())
+                kshare_page(P2K(PTE_ADDRESS(pte)));
+        }
+        else if(IS_SWAP_PTE(pte))
+            swap_dup(pte);
+        copy[i] = pte;
+    }
+    *pmd = K2P(copy) | PTE_TABLE;
+    // not the last reference, only the last one takes the table over
+    kfree_page(table);
+    _release_spinlock(&table_lock);
+    // the translations of the 2 MB were read only and may be cached
+    flush_tlb_pgdir(pd);
+    return true;
+}
+
+bool drop_table(struct tlb_gather* tlb, u64 va)
+{
+    PTEntriesPtr pmd = get_pmd(tlb->pd, va, false);
+    ASSERT(pmd && IS_SHARED_TABLE(*pmd));
+    void* table = (void*)P2K(PTE_ADDRESS(*pmd));
+    _acquire_spinlock(&table_lock);
+    if(get_page_ref((u64)table) == 1){
+        *pmd &= ~PTE_TABLE_RO;
+        _release_spinlock(&table_lock);
+        return false;
+    }
+    // not the last reference, the table is not freed before the flush
+    *pmd = NULL;
+    kfree_page(table);
+    _release_spinlock(&table_lock);
+    tlb_gather_all(tlb);
+    return true;
+}
+
+// drop the reference of a block mapping to its pages
+static void _unmap_block(PTEntriesPtr pmd){
+    kfree_pages((void*)P2K(PTE_ADDRESS(*pmd)));
+    *pmd = NULL;
+    __atomic_sub_fetch(&huge_live, 1, __ATOMIC_RELAXED);
 }
 
 void free_pte(PTEntriesPtr ptb, int level){
@@ -70,6 +216,23 @@ void free_pte(PTEntriesPtr ptb, int level){
         }
     }
     for(int i = 0; i < N_PTE_PER_TABLE; i++){
+        if(level == 2 && IS_BLOCK_PTE(ptb[i])){
+            // left by a split which ran out of memory
+            _unmap_block(ptb + i);
+            continue;
+        }
+        if(level == 2 && IS_SHARED_TABLE(ptb[i])){
+            // still used by other page tables, or left by an unshare which
+            // ran out of memory
+            _acquire_spinlock(&table_lock);
+            void* table = (void*)P2K(PTE_ADDRESS(ptb[i]));
+            if(get_page_ref((u64)table) > 1){
+                kfree_page(table);
+                _release_spinlock(&table_lock);
+                continue;
+            }
+            _release_spinlock(&table_lock);
+        }
         if(ptb[i]){
             memset((void*)P2K(PTE_ADDRESS(ptb[i])), NULL, PAGE_SIZE);
             kfree_page((void*)P2K(PTE_ADDRESS(ptb[i])));
@@ -84,17 +247,24 @@ void free_pgdir(struct pgdir* pgdir)
     // DONT FREE PAGES DESCRIBED BY THE PAGE TABLE
     
     free_sections(pgdir);
+    // kswapd may look at the page table until it is gone
+    _acquire_spinlock(&pgdir->lock);
     if(pgdir->pt){
         free_pte(pgdir->pt, 0);
         memset(pgdir->pt, NULL, PAGE_SIZE);
         kfree_page(pgdir->pt);
+        pgdir->pt = NULL;
     }
+    // a new page table gets a new ASID, the stale entries of the old one
+    // are flushed when its generation rolls over
+    pgdir->asid = 0;
+    _release_spinlock(&pgdir->lock);
 }
 
 void attach_pgdir(struct pgdir *pgdir) {
     extern PTEntries invalid_pt;
     if (pgdir->pt)
-        arch_set_ttbr0(K2P(pgdir->pt));
+        arch_set_ttbr0(K2P(pgdir->pt) | asid_switch(pgdir) << 48);
     else
         arch_set_ttbr0(K2P(&invalid_pt));
 }
@@ -108,7 +278,125 @@ void vmmap(struct pgdir *pd, u64 va, void *ka, u64 flags) {
     PTEntriesPtr pte = get_pte(pd, va, true);
     ASSERT(pte);
     *pte = PAGE_BASE(pa) | flags;
-    arch_tlbi_vmalle1is();
+    flush_tlb_page(pd, va);
+}
+
+// 2 MB blocks of user memory are mapped by level 2 entries. A block comes
+// from kalloc_pages() and its reference count is the one of its first page,
+// so it is shared by fork like a page. A block which has to be mapped by
+// pages again is split, in place if it is not shared.
+
+bool huge_unmapped(struct pgdir* pd, u64 va)
+{
+    PTEntriesPtr pmd = get_pmd(pd, va, false);
+    if(pmd == NULL || *pmd == NULL)return true;
+    if(IS_BLOCK_PTE(*pmd))return false;
+    PTEntriesPtr table = (PTEntriesPtr)P2K(PTE_ADDRESS(*pmd));
+    for(int i = 0; i < N_PTE_PER_TABLE; i++)
+        if(table[i])return false;
+    return true;
+}
+
+void vmmap_huge(struct pgdir* pd, u64 va, void* ka, u64 flags)
+{
+    ASSERT(HUGE_BASE(va) == va && HUGE_BASE(K2P(ka)) == K2P(ka));
+    PTEntriesPtr pmd = get_pmd(pd, va, true);
+    if(*pmd){
+        // an empty page table left by earlier mappings
+        ASSERT(!IS_BLOCK_PTE(*pmd) && huge_unmapped(pd, va));
+        kfree_page((void*)P2K(PTE_ADDRESS(*pmd)));
+    }
+    *pmd = K2P(ka) | flags;
+    __atomic_add_fetch(&huge_live, 1, __ATOMIC_RELAXED);
+    flush_tlb_page(pd, va);
+}
+
+bool alloc_huge(struct pgdir* pd, u64 va, u64 flags)
+{
+    va = HUGE_BASE(va);
+    if(!huge_unmapped(pd, va))return false;
+    void* block = kalloc_pages(HUGE_PAGE_ORDER);
+    if(block == NULL)return false;
+    memset(block, 0, HUGE_PAGE_SIZE);
+    vmmap_huge(pd, va, block, flags);
+    __atomic_add_fetch(&huge_faults, 1, __ATOMIC_RELAXED);
+    return true;
+}
+
+void unmap_huge(struct tlb_gather* tlb, u64 va)
+{
+    PTEntriesPtr pmd = get_pmd(tlb->pd, va, false);
+    ASSERT(pmd && IS_BLOCK_PTE(*pmd));
+    void* block = (void*)P2K(PTE_ADDRESS(*pmd));
+    *pmd = NULL;
+    __atomic_sub_fetch(&huge_live, 1, __ATOMIC_RELAXED);
+    tlb_gather_block(tlb, va, block);
+}
+
+bool split_huge(struct pgdir* pd, u64 va)
+{
+    PTEntriesPtr pmd = get_pmd(pd, va, false);
+    ASSERT(pmd && IS_BLOCK_PTE(*pmd));
+    void* block = (void*)P2K(PTE_ADDRESS(*pmd));
+    u64 flags = (PTE_FLAGS(*pmd) & ~0x3ull) | PTE_PAGE;
+    PTEntriesPtr table = (PTEntriesPtr)kalloc_page_zeroed();
+    if(table == NULL)return false;
+    if(get_page_ref((u64)block) == 1){
+        split_pages(block);
+        for(int i = 0; i < N_PTE_PER_TABLE; i++)
+            table[i] = K2P(block + i * PAGE_SIZE) | flags;
+    }
+    else{
+        // shared with another process, give this one its own copy
+        for(int i = 0; i < N_PTE_PER_TABLE; i++){
+            void* page = kalloc_page();
+            if(page == NULL){
+                while(i--)kfree_page((void*)P2K(PTE_ADDRESS(table[i])));
+                kfree_page(table);
+                return false;
+            }
+            memcpy(page, block + i * PAGE_SIZE, PAGE_SIZE);
+            table[i] = K2P(page) | flags;
+        }
+        kfree_pages(block);
+    }
+    *pmd = K2P(table) | PTE_TABLE;
+    __atomic_sub_fetch(&huge_live, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&huge_splits, 1, __ATOMIC_RELAXED);
+    flush_tlb_page(pd, va);
+    return true;
+}
+
+bool cow_huge(struct pgdir* pd, u64 va)
+{
+    PTEntriesPtr pmd = get_pmd(pd, va, false);
+    ASSERT(pmd && IS_BLOCK_PTE(*pmd));
+    void* block = (void*)P2K(PTE_ADDRESS(*pmd));
+    if(get_page_ref((u64)block) == 1){
+        *pmd &= ~(u64)PTE_RO;
+        flush_tlb_page(pd, va);
+        return true;
+    }
+    void* copy = kalloc_pages(HUGE_PAGE_ORDER);
+    if(copy == NULL){
+        // the pages are copied by the split, and made writable by the
+        // following page faults
+        return split_huge(pd, va);
+    }
+    memcpy(copy, block, HUGE_PAGE_SIZE);
+    *pmd = K2P(copy) | (PTE_FLAGS(*pmd) & ~(u64)PTE_RO);
+    kfree_pages(block);
+    __atomic_add_fetch(&huge_copies, 1, __ATOMIC_RELAXED);
+    flush_tlb_page(pd, va);
+    return true;
+}
+
+void get_hugestat(struct hugestat* st)
+{
+    st->live = __atomic_load_n(&huge_live, __ATOMIC_RELAXED);
+    st->faults = __atomic_load_n(&huge_faults, __ATOMIC_RELAXED);
+    st->splits = __atomic_load_n(&huge_splits, __ATOMIC_RELAXED);
+    st->copies = __atomic_load_n(&huge_copies, __ATOMIC_RELAXED);
 }
 
 /*
@@ -116,19 +404,36 @@ void vmmap(struct pgdir *pd, u64 va, void *ka, u64 flags) {
  * Allocate physical pages if required.
  * Useful when pgdir is not the current page table.
  */
-int copyout(struct pgdir *pd, void *va, void *p, usize len) {
-    // TODO
-    while (len > 0){
-        usize cur_sz = MIN(len, PAGE_SIZE - VA_OFFSET(va));
-        auto pte = get_pte(pd, (u64)va, true);
-        if(*pte == NULL){
-            void* tmp = kalloc_page();
-            *pte = K2P(tmp) | PTE_USER_DATA;
-        }
-        memcpy((void*)(P2K(PTE_ADDRESS(*pte)) + VA_OFFSET(va)), p, cur_sz);
-        len -= cur_sz;
-        p += cur_sz;
-        va += cur_sz;
+struct copyout_arg {
+    u64 begin, end;
+    void* p;
+};
+
+// copy the part of [begin, end) in the `size` bytes at `va` mapped to `ka`
+static void _copyout_to(struct copyout_arg* a, u64 va, void* ka, u64 size){
+    u64 from = MAX(va, a->begin);
+    u64 to = MIN(va + size, a->end);
+    memcpy(ka + (from - va), a->p + (from - a->begin), to - from);
+}
+
+static int _copyout_block(struct pt_walk* w, u64 va, PTEntriesPtr pmd){
+    _copyout_to(w->arg, va, (void*)P2K(PTE_ADDRESS(*pmd)), HUGE_PAGE_SIZE);
+    return 0;
+}
+
+static int _copyout_pte(struct pt_walk* w, u64 va, PTEntriesPtr pte){
+    if(*pte == NULL){
+        // the rest of the page is seen by the user
+        void* tmp = kalloc_page_zeroed();
+        if(!tmp)return -1;
+        *pte = K2P(tmp) | PTE_USER_DATA;
     }
+    _copyout_to(w->arg, va, (void*)P2K(PTE_ADDRESS(*pte)), PAGE_SIZE);
     return 0;
+}
+
+int copyout(struct pgdir *pd, void *va, void *p, usize len) {
+    struct copyout_arg arg = {(u64)va, (u64)va + len, p};
+    struct pt_walk w = {pd, true, _copyout_block, NULL, _copyout_pte, &arg};
+    return walk_range(&w, (u64)va, (u64)va + len) ? -1 : 0;
 }
\ No newline at end of file
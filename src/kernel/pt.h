@@ -2,16 +2,82 @@
 
 #include <aarch64/mmu.h>
 #include <common/list.h>
+#include <common/rbtree.h>
 
 struct pgdir {
     PTEntriesPtr pt;
     SpinLock lock;
     ListNode section_head;
+    // the sections again, ordered by begin, see section_find
+    struct rb_root_ section_tree;
+    struct section *last_section;   // the last one found
+    struct section *heap;
+    u64 asid;   // see kernel/tlb.h, 0 until it first runs
+};
+
+struct hugestat {
+    u64 live;       // block mappings in all page tables
+    u64 faults;     // blocks allocated by page faults
+    u64 splits;     // block mappings split into pages
+    u64 copies;     // shared blocks copied on write
 };
 
 void init_pgdir(struct pgdir *pgdir);
+// NULL if `va` is mapped by a 2 MB block, see get_pmd
 WARN_RESULT PTEntriesPtr get_pte(struct pgdir *pgdir, u64 va, bool alloc);
+// the level 2 entry of `va`, a page table or a 2 MB block
+WARN_RESULT PTEntriesPtr get_pmd(struct pgdir *pgdir, u64 va, bool alloc);
 void vmmap(struct pgdir *pd, u64 va, void *ka, u64 flags);
+
+// A walk over the page table entries of [begin, end) of `pd`, level by
+// level. Subtrees without a table are skipped, or allocated with `alloc`.
+// The callbacks get the address the entry maps from, and stop the walk by
+// returning non-zero, which walk_range() returns.
+struct pt_walk {
+    struct pgdir *pd;
+    bool alloc;
+    // a 2 MB block, NULL to skip blocks. If it leaves a page table in the
+    // entry, e.g. by split_huge(), the walk goes on into it
+    int (*block)(struct pt_walk *w, u64 va, PTEntriesPtr pmd);
+    // a level 2 entry of a page table, before the walk goes into it. The
+    // walk does not go into a shared table. Without it, a walk with
+    // `alloc` unshares the table and one without skips it
+    int (*table)(struct pt_walk *w, u64 va, PTEntriesPtr pmd);
+    // a level 3 entry which is not 0, or any entry with `alloc`
+    int (*pte)(struct pt_walk *w, u64 va, PTEntriesPtr pte);
+    void *arg;
+};
+int walk_range(struct pt_walk *w, u64 begin, u64 end);
+
+// A level 3 table can be shared by the page tables fork makes: their
+// level 2 entries all point to it, read only, and its reference count is
+// the number of page tables sharing it. Its pages and swap slots are
+// referenced once, by the table. The first fault which changes it copies
+// it, see unshare_table().
+#define IS_SHARED_TABLE(pmd) (((pmd) & 0x3) == PTE_TABLE && ((pmd) & PTE_TABLE_RO))
+struct tlb_gather;
+// give `pd` its own copy of the shared table of `va`, false if there is no
+// memory
+WARN_RESULT bool unshare_table(struct pgdir *pd, u64 va);
+// remove the shared table of `va` from tlb->pd. False if no other page
+// table shares it any more, it is then private to tlb->pd and stays mapped
+WARN_RESULT bool drop_table(struct tlb_gather *tlb, u64 va);
+
+// true if no page in the 2 MB block of `va` is mapped or swapped out
+bool huge_unmapped(struct pgdir *pd, u64 va);
+// map the 2 MB block `ka` at the 2 MB aligned `va`, which must be unmapped
+void vmmap_huge(struct pgdir *pd, u64 va, void *ka, u64 flags);
+// map a new zeroed block over the 2 MB block of `va`, false if it is not
+// unmapped or there is no free block
+WARN_RESULT bool alloc_huge(struct pgdir *pd, u64 va, u64 flags);
+// remove the block mapping of `va` in tlb->pd, the block is freed by the
+// flush of `tlb`
+void unmap_huge(struct tlb_gather *tlb, u64 va);
+// map the block of `va` by pages, false if there is no memory
+WARN_RESULT bool split_huge(struct pgdir *pd, u64 va);
+// a write to the read only block of `va`, false if there is no memory
+WARN_RESULT bool cow_huge(struct pgdir *pd, u64 va);
+void get_hugestat(struct hugestat *);
 void free_pgdir(struct pgdir *pgdir);
 void attach_pgdir(struct pgdir *pgdir);
 int copyout(struct pgdir *pd, void *va, void *p, usize len);
\ No newline at end of file
@@ -6,53 +6,451 @@
 #include <aarch64/intrinsic.h>
 #include <kernel/cpu.h>
 #include <driver/clock.h>
+#include <driver/ipi.h>
+#include <aarch64/fpsimd.h>
+#include <kernel/schedtrace.h>
 
-#define NLEVEL 3
 #define TIME_TO_LEVEL_UP_MS 1000
 #define TIME_SLICE_LEN 5
+#define BALANCE_INTERVAL_MS 10
+
+// cfs: every runnable process runs once in a period of SCHED_LATENCY_MS
+// (or MIN_GRANULARITY_MS each if there are too many of them)
+#define SCHED_LATENCY_MS 20
+#define MIN_GRANULARITY_MS 2
+#define WAKEUP_GRANULARITY_MS 1
+#define NICE_0_LOAD 1024
+
+// deadline: bandwidth is runtime / period in 1 / 2^DL_BW_SHIFT, a cpu
+// admits deadline processes up to DL_BW_LIMIT
+#define DL_BW_SHIFT 20
+#define DL_BW_LIMIT (95 * (1 << DL_BW_SHIFT) / 100)
 
 extern bool panic_flag;
 
 extern void swtch(KernelContext* new_ctx, KernelContext** old_ctx);
 
-static SpinLock mlfq_lock;
-// static ListNode rq;
-static ListNode mlfq[NLEVEL];
 static u64 time_slice[NLEVEL];
-bool level_up_timer_set = false;
-struct timer level_up_timer;
+struct timer level_up_timers[NCPU];
+struct timer balance_timers[NCPU];
 struct timer time_slice_timers[NCPU];
+struct timer dl_timers[NCPU];
+
+// admitted deadline bandwidth of each cpu
+static SpinLock dl_bw_lock;
+static u64 dl_bw[NCPU];
+
+#define this_rq() (&cpus[cpuid()].sched)
+
+static ALWAYS_INLINE u64 ms_to_ticks(u64 ms){
+    return get_clock_frequency() / 1000 * ms;
+}
+
+static ALWAYS_INLINE int ticks_to_ms(u64 ticks){
+    u64 tpm = get_clock_frequency() / 1000;
+    return (ticks + tpm - 1) / tpm;
+}
+
+#define _is_dl(p) ((p)->schinfo.dl_runtime != 0)
+
+static bool __deadline_cmp(rb_node lnode, rb_node rnode)
+{
+    i64 d = container_of(lnode, struct proc, schinfo.dl_node)->schinfo.dl_abs_deadline
+          - container_of(rnode, struct proc, schinfo.dl_node)->schinfo.dl_abs_deadline;
+    if (d < 0)
+        return true;
+    if (d == 0)
+        return lnode < rnode;
+    return false;
+}
+
+// the deadline process with the earliest deadline, or NULL
+static struct proc* _dl_first(struct sched* rq){
+    auto node = _rb_first(&rq->dl_tree);
+    return node ? container_of(node, struct proc, schinfo.dl_node) : NULL;
+}
+
+// start a new period of p at `now`
+static void _dl_replenish(struct proc* p, u64 now){
+    p->schinfo.dl_budget = p->schinfo.dl_runtime;
+    p->schinfo.dl_abs_deadline = now + p->schinfo.dl_deadline;
+}
+
+// when the current period of a throttled process ends
+static u64 _dl_next_period(struct proc* p){
+    return p->schinfo.dl_abs_deadline - p->schinfo.dl_deadline + p->schinfo.dl_period;
+}
+
+#if SCHED_CFS
+
+// weight of nice -20 ... 19, each step is about 10% of cpu time
+static const u64 nice_to_weight[NICE_MAX - NICE_MIN + 1] = {
+    88761, 71755, 56483, 46273, 36291,
+    29154, 23254, 18705, 14949, 11916,
+    9548, 7620, 6100, 4904, 3906,
+    3121, 2501, 1991, 1586, 1277,
+    1024, 820, 655, 526, 423,
+    335, 272, 215, 172, 137,
+    110, 87, 70, 56, 45,
+    36, 29, 23, 18, 15,
+};
+
+#define proc_weight(p) nice_to_weight[(p)->schinfo.nice - NICE_MIN]
 
-void _do_level_up(){
+static bool __vruntime_cmp(rb_node lnode, rb_node rnode)
+{
+    i64 d = container_of(lnode, struct proc, schinfo.cfs_node)->schinfo.vruntime
+          - container_of(rnode, struct proc, schinfo.cfs_node)->schinfo.vruntime;
+    if (d < 0)
+        return true;
+    if (d == 0)
+        return lnode < rnode;
+    return false;
+}
+
+static void _rq_enqueue(struct sched* rq, struct proc* p){
+    ASSERT(0 == _rb_insert(&p->schinfo.cfs_node, &rq->cfs_tree, __vruntime_cmp));
+    rq->load += proc_weight(p);
+    rq->nr_ready++;
+}
+
+static void _rq_dequeue(struct sched* rq, struct proc* p){
+    _rb_erase(&p->schinfo.cfs_node, &rq->cfs_tree);
+    rq->load -= proc_weight(p);
+    rq->nr_ready--;
+    if(rq->handoff == p)rq->handoff = NULL;
+}
+
+// the process with the smallest vruntime, or NULL
+static struct proc* _rq_first(struct sched* rq){
+    auto node = _rb_first(&rq->cfs_tree);
+    return node ? container_of(node, struct proc, schinfo.cfs_node) : NULL;
+}
+
+// vruntime of the running process p, including the time since exec_start
+static u64 _curr_vruntime(struct proc* p){
+    u64 delta = get_timestamp() - p->schinfo.exec_start;
+    return p->schinfo.vruntime + delta * NICE_0_LOAD / proc_weight(p);
+}
+
+// charge the running process p and advance min_vruntime
+static void _update_curr(struct sched* rq, struct proc* p){
+    p->schinfo.vruntime = _curr_vruntime(p);
+    p->schinfo.exec_start = get_timestamp();
+    u64 vruntime = p->schinfo.vruntime;
+    auto first = _rq_first(rq);
+    if(first)vruntime = MIN(vruntime, first->schinfo.vruntime);
+    rq->min_vruntime = MAX(rq->min_vruntime, vruntime);
+}
+
+// move p onto the vruntime scale of rq, `base` is the min_vruntime of the
+// queue p comes from. a sleeper gets at most half a period of credit.
+static void _place_proc(struct sched* rq, struct proc* p, u64 base){
+    i64 lag = p->schinfo.vruntime - base;
+    i64 credit = MIN((i64)ms_to_ticks(SCHED_LATENCY_MS / 2), (i64)rq->min_vruntime);
+    if(lag < -credit)lag = -credit;
+    p->schinfo.vruntime = rq->min_vruntime + lag;
+}
+
+// the time slice of p in ms, weighted by nice
+static int _cfs_slice(struct sched* rq, struct proc* p){
+    u64 period = SCHED_LATENCY_MS, nr = rq->nr_ready + 1;
+    if(nr * MIN_GRANULARITY_MS > period)period = nr * MIN_GRANULARITY_MS;
+    u64 slice = period * proc_weight(p) / (rq->load + proc_weight(p));
+    return MAX(slice, (u64)MIN_GRANULARITY_MS);
+}
+
+#else
+
+static void _rq_enqueue(struct sched* rq, struct proc* p){
+    _insert_into_list(rq->mlfq[p->schinfo.level].prev, &p->schinfo.rq);
+    rq->bitmap |= BIT(p->schinfo.level);
+    rq->nr_ready++;
+}
+
+static void _rq_dequeue(struct sched* rq, struct proc* p){
+    if(!_detach_from_list(&p->schinfo.rq))PANIC();
+    if(_empty_list(&rq->mlfq[p->schinfo.level]))rq->bitmap &= ~BIT(p->schinfo.level);
+    rq->nr_ready--;
+    if(rq->handoff == p)rq->handoff = NULL;
+}
+
+// the first process of the highest non-empty level, or NULL
+static struct proc* _rq_first(struct sched* rq){
+    if(!rq->bitmap)return NULL;
+    int level = __builtin_ctzll(rq->bitmap);
+    return container_of(rq->mlfq[level].next, struct proc, schinfo.rq);
+}
+
+#endif
+
+// queue p by its class
+// a throttled deadline process is queued by dl_timer_handler when replenished
+static void _enqueue(struct sched* rq, struct proc* p){
+    if(!_is_dl(p)){
+        _rq_enqueue(rq, p);
+        return;
+    }
+    if(p->schinfo.dl_throttled)return;
+    ASSERT(0 == _rb_insert(&p->schinfo.dl_node, &rq->dl_tree, __deadline_cmp));
+    rq->nr_ready++;
+}
+
+static void _dequeue(struct sched* rq, struct proc* p){
+    if(!_is_dl(p)){
+        _rq_dequeue(rq, p);
+        return;
+    }
+    _rb_erase(&p->schinfo.dl_node, &rq->dl_tree);
+    rq->nr_ready--;
+}
+
+// deadline processes always go before the others
+static struct proc* _pick_first(struct sched* rq){
+    auto p = _dl_first(rq);
+    return p ? p : _rq_first(rq);
+}
+
+// lock the run queue which p belongs to
+// p->schinfo.cpu may change before we get the lock, so check it again
+static struct sched* _lock_rq_of(struct proc* p){
+    while(1){
+        int cpu = __atomic_load_n(&p->schinfo.cpu, __ATOMIC_ACQUIRE);
+        auto rq = &cpus[cpu].sched;
+        _acquire_spinlock(&rq->lock);
+        if(cpu == p->schinfo.cpu)return rq;
+        _release_spinlock(&rq->lock);
+    }
+}
+
+void _do_level_up(struct sched* rq){
+    if(!(rq->bitmap & ~BIT(0)))return;
     for(int i = 1; i < NLEVEL; i++){
-        if(!_empty_list(&mlfq[i])){
-            ListNode* first = _detach_from_list(&mlfq[i]);
+        if(!_empty_list(&rq->mlfq[i])){
+            ListNode* first = _detach_from_list(&rq->mlfq[i]);
             first = first->next;
             _for_in_list(p, first){
                 auto proc = container_of(p, struct proc, schinfo.rq);
+                sched_trace(SCHED_EV_LEVEL, proc, i, 0);
                 proc->schinfo.level = 0;
             }
-            _merge_list(mlfq[0].prev, first);
+            _merge_list(rq->mlfq[0].prev, first);
         }
     }
+    rq->bitmap = BIT(0);
 }
 
 static void level_up_timer_handler(struct timer* timer){
     timer->data++;
-    _acquire_spinlock(&mlfq_lock);
-    _do_level_up();
-    _release_spinlock(&mlfq_lock);
+    auto rq = this_rq();
+    _acquire_spinlock(&rq->lock);
+    _do_level_up(rq);
+    _release_spinlock(&rq->lock);
+}
+
+// move the first runnable process of src to dst
+// both locks must be held
+static bool _migrate_one(struct sched* src, struct sched* dst, int dst_cpu){
+    auto proc = _rq_first(src);
+    if(!proc)return false;
+    _rq_dequeue(src, proc);
+    sched_trace(SCHED_EV_MIGRATE, proc, proc->schinfo.cpu, dst_cpu);
+    __atomic_store_n(&proc->schinfo.cpu, dst_cpu, __ATOMIC_RELEASE);
+#if SCHED_CFS
+    _place_proc(dst, proc, src->min_vruntime);
+#endif
+    _rq_enqueue(dst, proc);
+    return true;
+}
+
+// called with the lock of this cpu held and nothing to run
+// only try-lock the others to avoid deadlock
+static bool _steal_work(){
+    int cpu = cpuid();
+    for(int i = 1; i < NCPU; i++){
+        auto victim = &cpus[(cpu + i) % NCPU].sched;
+        if(victim->nr_ready == 0)continue;
+        if(!_try_acquire_spinlock(&victim->lock))continue;
+        bool ok = _migrate_one(victim, this_rq(), cpu);
+        _release_spinlock(&victim->lock);
+        if(ok)return true;
+    }
+    return false;
+}
+
+// arm or stop the timers of this cpu for the process about to run
+// called with the lock of this cpu held
+static void _update_tick(struct sched* rq){
+    int cpu = cpuid();
+    auto slice = &time_slice_timers[cpu];
+    bool idle = rq->thisproc->idle;
+    bool need_tick = !idle && (!TICKLESS || rq->nr_ready > 0 || _is_dl(rq->thisproc));
+    if(need_tick && slice->triggered)set_cpu_timer(slice);
+    if(!need_tick && !slice->triggered){
+        cancel_cpu_timer(slice);
+        slice->triggered = true;
+    }
+    rq->tick_stopped = !need_tick;
+    if(!SCHED_CFS && !idle && level_up_timers[cpu].triggered)set_cpu_timer(&level_up_timers[cpu]);
+    if(!idle && balance_timers[cpu].triggered)set_cpu_timer(&balance_timers[cpu]);
+}
+
+// whether p should preempt the running process of rq
+static bool _should_preempt(struct sched* rq, struct proc* p){
+    auto curr = rq->thisproc;
+    if(p->schinfo.dl_throttled)return false;
+    if(curr->idle)return true;
+    if(_is_dl(p))return !_is_dl(curr) || p->schinfo.dl_abs_deadline < curr->schinfo.dl_abs_deadline;
+    if(_is_dl(curr))return false;
+#if SCHED_CFS
+    return (i64)(_curr_vruntime(curr) - p->schinfo.vruntime) > (i64)ms_to_ticks(WAKEUP_GRANULARITY_MS);
+#else
+    return p->schinfo.level < curr->schinfo.level;
+#endif
+}
+
+static void _kick_cpu(int cpu){
+    __atomic_fetch_add(&this_rq()->nr_ipis, 1, __ATOMIC_RELAXED);
+    send_ipi(cpu, IPI_RESCHEDULE);
+}
+
+// an idle cpu other than `except` and this one, or -1
+static int _find_idle_cpu(int except){
+    for(int i = 0; i < NCPU; i++){
+        auto rq = &cpus[i].sched;
+        if(i == except || i == cpuid() || !cpus[i].online)continue;
+        if(rq->thisproc->idle && rq->nr_ready == 0)return i;
+    }
+    return -1;
+}
+
+// pull half of the imbalance from the busiest cpu
+static void balance_timer_handler(struct timer* timer){
+    timer->data++;
+    int cpu = cpuid(), busiest = -1;
+    auto rq = this_rq();
+    int max_load = rq->nr_ready + 1;
+    for(int i = 0; i < NCPU; i++){
+        if(i != cpu && cpus[i].sched.nr_ready > max_load){
+            busiest = i;
+            max_load = cpus[i].sched.nr_ready;
+        }
+    }
+    _acquire_spinlock(&rq->lock);
+    if(busiest >= 0){
+        auto src = &cpus[busiest].sched;
+        if(_try_acquire_spinlock(&src->lock)){
+            int n = (src->nr_ready - rq->nr_ready) / 2;
+            while(n-- > 0 && _migrate_one(src, rq, cpu));
+            _release_spinlock(&src->lock);
+        }
+    }
+    _update_tick(rq);
+    bool overloaded = rq->nr_ready > 0;
+    _release_spinlock(&rq->lock);
+    // idle cpus do not tick, wake one up to steal from us
+    if(overloaded){
+        int idle = _find_idle_cpu(cpu);
+        if(idle >= 0)_kick_cpu(idle);
+    }
+}
+
+// restart the tick or preempt the current process for a new arrival
+static void resched_ipi_handler(u32 type){
+    (void)type;
+    auto rq = this_rq();
+    _acquire_spinlock(&rq->lock);
+    _update_tick(rq);
+    auto this = rq->thisproc;
+    auto next = _pick_first(rq);
+    if(!this->idle && next && _should_preempt(rq, next)){
+        _sched(RUNNABLE);
+        return;
+    }
+    _release_spinlock(&rq->lock);
+}
+
+define_early_init(resched_ipi){
+    set_ipi_handler(resched_ipi_handler);
+}
+
+// arm the replenishment timer of this cpu for its earliest throttled process
+static void _dl_arm_timer(struct sched* rq){
+    auto timer = &dl_timers[cpuid()];
+    if(!timer->triggered){
+        cancel_cpu_timer(timer);
+        timer->triggered = true;
+    }
+    if(_empty_list(&rq->dl_throttled))return;
+    u64 next = (u64)-1, now = get_timestamp();
+    _for_in_list(node, &rq->dl_throttled){
+        if(node == &rq->dl_throttled)break;
+        auto p = container_of(node, struct proc, schinfo.rq);
+        next = MIN(next, _dl_next_period(p));
+    }
+    timer->elapse = next > now ? ticks_to_ms(next - now) : 0;
+    set_cpu_timer(timer);
+}
+
+// p has used up its budget, wait for the next period
+static void _dl_throttle(struct sched* rq, struct proc* p){
+    p->schinfo.dl_throttled = true;
+    _insert_into_list(rq->dl_throttled.prev, &p->schinfo.rq);
+    _dl_arm_timer(rq);
+}
+
+// replenish the throttled processes whose next period has come
+static void dl_timer_handler(struct timer* timer){
+    timer->data++;
+    auto rq = this_rq();
+    _acquire_spinlock(&rq->lock);
+    u64 now = get_timestamp();
+    ListNode* node = rq->dl_throttled.next;
+    while(node != &rq->dl_throttled){
+        auto p = container_of(node, struct proc, schinfo.rq);
+        node = node->next;
+        if(_dl_next_period(p) > now)continue;
+        _detach_from_list(&p->schinfo.rq);
+        p->schinfo.dl_throttled = false;
+        _dl_replenish(p, now);
+        // a sleeping one will be queued when activated
+        if(p->state == RUNNABLE)_enqueue(rq, p);
+    }
+    _dl_arm_timer(rq);
+    _update_tick(rq);
+    auto this = rq->thisproc;
+    auto next = _pick_first(rq);
+    if(!this->idle && next && _should_preempt(rq, next)){
+        _sched(RUNNABLE);
+        return;
+    }
+    _release_spinlock(&rq->lock);
+}
+
+define_init(dl_timers){
+    init_spinlock(&dl_bw_lock);
+    for(int i = 0; i < NCPU; i++){
+        dl_timers[i].triggered = true;
+        dl_timers[i].handler = dl_timer_handler;
+    }
 }
 
-define_init(level_up_timer){
-    level_up_timer.triggered = true;
-    level_up_timer.elapse = TIME_TO_LEVEL_UP_MS;
-    level_up_timer.handler = level_up_timer_handler;
+define_init(sched_timers){
+    for(int i = 0; i < NCPU; i++){
+        level_up_timers[i].triggered = true;
+        level_up_timers[i].elapse = TIME_TO_LEVEL_UP_MS;
+        level_up_timers[i].handler = level_up_timer_handler;
+        balance_timers[i].triggered = true;
+        balance_timers[i].elapse = BALANCE_INTERVAL_MS;
+        balance_timers[i].handler = balance_timer_handler;
+    }
 }
 
 static void time_slice_finished(struct timer* timer){
     timer->data++;
-    thisproc()->schinfo.left_time_slices--;
+#if !SCHED_CFS
+    if(!_is_dl(thisproc()))thisproc()->schinfo.left_time_slices--;
+#endif
     _acquire_sched_lock();
     _sched(RUNNABLE);
 }
@@ -67,20 +465,34 @@ define_init(time_slice_timers){
 
 define_early_init(mlfq)
 {
-    init_spinlock(&mlfq_lock);
-    init_list_node(&mlfq[0]);
     for(int i = 0; i < NLEVEL; i++){
-        init_list_node(&mlfq[i]);
         time_slice[i] = 5 * (i + 1);
-    }    
+    }
+    for(int c = 0; c < NCPU; c++){
+        auto rq = &cpus[c].sched;
+        init_spinlock(&rq->lock);
+        for(int i = 0; i < NLEVEL; i++){
+            init_list_node(&rq->mlfq[i]);
+        }
+        rq->bitmap = 0;
+        rq->cfs_tree.rb_node = NULL;
+        rq->min_vruntime = rq->load = 0;
+        rq->nr_ready = 0;
+        rq->handoff = NULL;
+        rq->dl_tree.rb_node = NULL;
+        init_list_node(&rq->dl_throttled);
+        rq->migrating = NULL;
+        rq->migrate_to = 0;
+    }
 }
 
 define_init(sched)
 {
     for(int i = 0; i < NCPU; ++i){
-        struct proc* p = kalloc(sizeof(struct proc));
+        struct proc* p = kmem_cache_alloc(proc_cache);
         p->idle = 1;
         p->state = RUNNING;
+        p->schinfo.cpu = i;
         cpus[i].sched.thisproc = cpus[i].sched.idle = p;
     }
 }
@@ -97,66 +509,212 @@ void init_schinfo(struct schinfo* p)
     init_list_node(&p->rq);
     p->level = 0;
     p->left_time_slices = time_slice[0];
+    p->cpu = cpuid();
+    p->nice = 0;
+    p->vruntime = 0;
+    p->dl_runtime = 0;
+    p->dl_throttled = false;
 }
 
 void _acquire_sched_lock()
 {
     // TODO: acquire the sched_lock if need
-    _acquire_spinlock(&mlfq_lock);
+    _acquire_spinlock(&this_rq()->lock);
 }
 
 void _release_sched_lock()
 {
     // TODO: release the sched_lock if need
-    _release_spinlock(&mlfq_lock);
+    _release_spinlock(&this_rq()->lock);
+}
+
+void set_nice(int nice)
+{
+    nice = MAX(NICE_MIN, MIN(nice, NICE_MAX));
+    _acquire_sched_lock();
+#if SCHED_CFS
+    _update_curr(this_rq(), thisproc());
+#endif
+    thisproc()->schinfo.nice = nice;
+    _release_sched_lock();
+}
+
+// give the bandwidth of p back to its cpu
+static void _dl_release_bw(struct proc* p){
+    _acquire_spinlock(&dl_bw_lock);
+    dl_bw[p->schinfo.cpu] -= (p->schinfo.dl_runtime << DL_BW_SHIFT) / p->schinfo.dl_period;
+    _release_spinlock(&dl_bw_lock);
+}
+
+int set_deadline(u64 runtime, u64 deadline, u64 period)
+{
+    auto p = thisproc();
+    int cpu = cpuid(), target = -1;
+    if(runtime && (runtime > deadline || deadline > period))
+        return -1;
+    u64 bw = runtime ? (runtime << DL_BW_SHIFT) / period : 0;
+    u64 old = _is_dl(p) ? (p->schinfo.dl_runtime << DL_BW_SHIFT) / p->schinfo.dl_period : 0;
+    // admission control, prefer this cpu
+    _acquire_spinlock(&dl_bw_lock);
+    dl_bw[cpu] -= old;
+    for(int i = 0; i < NCPU && runtime; i++){
+        int c = (cpu + i) % NCPU;
+        if((c == cpu || cpus[c].online) && dl_bw[c] + bw <= DL_BW_LIMIT){
+            target = c;
+            break;
+        }
+    }
+    if(runtime && target < 0){
+        dl_bw[cpu] += old;
+        _release_spinlock(&dl_bw_lock);
+        return -1;
+    }
+    if(runtime)dl_bw[target] += bw;
+    _release_spinlock(&dl_bw_lock);
+
+    _acquire_sched_lock();
+    p->schinfo.dl_runtime = ms_to_ticks(runtime);
+    p->schinfo.dl_deadline = ms_to_ticks(deadline);
+    p->schinfo.dl_period = ms_to_ticks(period);
+    p->schinfo.exec_start = get_timestamp();
+    _dl_replenish(p, p->schinfo.exec_start);
+    if(runtime && target != cpu){
+        // switch out and let the next process activate us on target
+        sched_trace(SCHED_EV_MIGRATE, p, cpu, target);
+        // schinfo.cpu changes once p is switched out, until then its run
+        // queue is the one of this cpu
+        this_rq()->migrating = p;
+        this_rq()->migrate_to = target;
+        _sched(DEEPSLEEPING);
+    }
+    else
+        _sched(RUNNABLE);
+    return 0;
 }
 
 bool is_zombie(struct proc* p)
 {
     bool r;
-    _acquire_sched_lock();
+    auto rq = _lock_rq_of(p);
     r = p->state == ZOMBIE;
-    _release_sched_lock();
+    _release_spinlock(&rq->lock);
     return r;
 }
 
 bool is_unused(struct proc* p)
 {
     bool r;
-    _acquire_sched_lock();
+    auto rq = _lock_rq_of(p);
     r = p->state == UNUSED;
-    _release_sched_lock();
+    _release_spinlock(&rq->lock);
     return r;
 }
 
-bool _activate_proc(struct proc* p, bool onalert)
+static bool _can_activate(struct proc* p, bool onalert){
+    return p->state == SLEEPING || p->state == UNUSED
+        || (p->state == DEEPSLEEPING && !onalert);
+}
+
+// wake-affine: whether to pull a process woken by the current process to
+// this cpu, where the data it is waiting for was just produced
+static bool _wake_affine(int cpu, int prev, bool sync){
+    auto this = &cpus[cpu].sched;
+    auto rq = &cpus[prev].sched;
+    if(this->thisproc == NULL || this->thisproc->idle)
+        return false;
+    // the waker will sleep soon and leave the cpu to the wakee
+    if(sync && this->nr_ready == 0)
+        return true;
+    // the previous cpu is idle, its cache is still warm
+    if(rq->thisproc->idle && rq->nr_ready == 0)
+        return false;
+    return this->nr_ready + 1 < rq->nr_ready;
+}
+
+// choose the run queue for a process to be activated
+// a new process goes to an idle cpu if there is one, otherwise keep the
+// process on the cpu where it ran last, whose cache is warm, unless the
+// waker's cpu is a better place
+static int _select_rq(struct proc* p, bool sync){
+    int cpu = cpuid(), prev = p->schinfo.cpu;
+    if(_is_dl(p))return cpus[prev].online ? prev : cpu;
+    if(p->state == UNUSED){
+        int idle = _find_idle_cpu(-1);
+        return idle >= 0 && cpus[cpu].online ? idle : cpu;
+    }
+    if(prev == cpu || !cpus[prev].online)return cpu;
+    if(cpus[cpu].online && _wake_affine(cpu, prev, sync))return cpu;
+    return prev;
+}
+
+bool _activate_proc(struct proc* p, bool onalert, bool sync)
 {
     // TODO
     // if the proc->state is RUNNING/RUNNABLE, do nothing and return false
     // if the proc->state is SLEEPING/UNUSED, set the process state to RUNNABLE, add it to the sched queue, and return true
     // if the proc->state is DEEPSLEEPING, do nothing if onalert or activate it if else, and return the corresponding value.
-    _acquire_sched_lock();
-    if(p->state == RUNNING || p->state == RUNNABLE || p->state == ZOMBIE){
-        _release_sched_lock();
+    auto rq = _lock_rq_of(p);
+    if(!_can_activate(p, onalert)){
+        _release_spinlock(&rq->lock);
         return false;
     }
-    else if(p->state == SLEEPING || p->state == UNUSED){
-        p->state = RUNNABLE;
-        _insert_into_list(mlfq[p->schinfo.level].prev, &p->schinfo.rq);
+    u64 base = rq->min_vruntime;
+    int target = _select_rq(p, sync);
+    if(target != p->schinfo.cpu){
+        // p is not on any queue, just move it to the target cpu
+        __atomic_store_n(&p->schinfo.cpu, target, __ATOMIC_RELEASE);
+        _release_spinlock(&rq->lock);
+        rq = _lock_rq_of(p);
+        if(!_can_activate(p, onalert)){
+            _release_spinlock(&rq->lock);
+            return false;
+        }
+    }
+#if SCHED_CFS
+    if(p->state == UNUSED)p->schinfo.vruntime = rq->min_vruntime;
+    else _place_proc(rq, p, base);
+#else
+    (void)base;
+#endif
+    sched_trace(SCHED_EV_WAKEUP, p, sched_trace_pid(thisproc()), p->schinfo.cpu);
+    p->state = RUNNABLE;
+    p->schinfo.wakeup_ts = get_timestamp();
+    if(_is_dl(p) && !p->schinfo.dl_throttled){
+        // start a new period if the rest of the budget can not fit in
+        // the current one at the reserved bandwidth
+        u64 now = p->schinfo.wakeup_ts;
+        if(p->schinfo.dl_abs_deadline <= now
+            || p->schinfo.dl_budget * p->schinfo.dl_period
+                > (p->schinfo.dl_abs_deadline - now) * p->schinfo.dl_runtime)
+            _dl_replenish(p, now);
     }
-    else if (p->state == DEEPSLEEPING){
-        if(!onalert){
-            p->state = RUNNABLE;
-            _insert_into_list(mlfq[p->schinfo.level].prev, &p->schinfo.rq);
+    _enqueue(rq, p);
+    // the target cpu must notice the new arrival if it is idle, not
+    // ticking or running something of lower priority; otherwise let an
+    // idle cpu steal it
+    int kick = -1;
+    target = p->schinfo.cpu;
+    if(cpus[target].online){
+        auto curr = rq->thisproc;
+        if(rq == this_rq() && sync && !curr->idle && !_is_dl(p)){
+            // the waker is about to sleep, hand the cpu over to p. Only a
+            // hint: it is dropped if the waker keeps running, and an idle
+            // cpu may still take p
+            rq->handoff = p;
         }
-        else{
-            _release_sched_lock();
-            return false;
+        if(rq == this_rq()){
+            _update_tick(rq);
+            // preempt ourselves once back to user space
+            if(_is_dl(p) && !curr->idle && _should_preempt(rq, p))
+                kick = target;
         }
-        
+        else if(rq->tick_stopped || _should_preempt(rq, p))
+            kick = target;
+        if(kick < 0 && !curr->idle)
+            kick = _find_idle_cpu(target);
     }
-    
-    _release_sched_lock();
+    _release_spinlock(&rq->lock);
+    if(kick >= 0)_kick_cpu(kick);
     return true;
 }
 
@@ -166,14 +724,29 @@ static void update_this_state(enum procstate new_state)
     // update the state of current process to new_state, and remove it from the sched queue if new_state=SLEEPING/ZOMBIE
     if(new_state == RUNNING || new_state == UNUSED)PANIC();
     auto this = thisproc();
+    auto rq = this_rq();
     this->state = new_state;
-    if(!this->idle)_detach_from_list(&this->schinfo.rq);
-    if(this->schinfo.left_time_slices == 0){
-        if(this->schinfo.level < NLEVEL - 1)this->schinfo.level++;
+    // a sync waker which does not block gives up its claim to hand over
+    if(new_state != SLEEPING && new_state != DEEPSLEEPING && new_state != ZOMBIE)
+        rq->handoff = NULL;
+    if(_is_dl(this)){
+        this->schinfo.dl_budget -= get_timestamp() - this->schinfo.exec_start;
+        if(new_state == ZOMBIE)_dl_release_bw(this);
+        else if(this->schinfo.dl_budget <= 0)_dl_throttle(rq, this);
+    }
+#if SCHED_CFS
+    else if(!this->idle)_update_curr(rq, this);
+#else
+    else if(this->schinfo.left_time_slices == 0){
+        if(this->schinfo.level < NLEVEL - 1){
+            sched_trace(SCHED_EV_LEVEL, this, this->schinfo.level, this->schinfo.level + 1);
+            this->schinfo.level++;
+        }
         this->schinfo.left_time_slices = time_slice[this->schinfo.level];
     }
+#endif
     if(new_state == RUNNABLE && !this->idle){
-        _insert_into_list(mlfq[this->schinfo.level].prev, &this->schinfo.rq);
+        _enqueue(rq, this);
     }
     if(new_state == ZOMBIE){    // notify the parent proc here
         _release_sched_lock();
@@ -186,37 +759,68 @@ static struct proc* pick_next()
 {
     // TODO: if using simple_sched, you should implement this routinue
     // choose the next process to run, and return idle if no runnable process
-    for(int i = 0; i < NLEVEL; i++){
-        if(_empty_list(&mlfq[i]))continue;
-        _for_in_list(p, &mlfq[i]){
-            if(p == &mlfq[i])continue;
-            auto proc = container_of(p, struct proc, schinfo.rq);
-            if(proc->state == RUNNABLE)return proc;
-        }
-    }
-    return cpus[cpuid()].sched.idle;
+    auto rq = this_rq();
+    auto next = _dl_first(rq);
+    if(!next)next = rq->handoff ? rq->handoff : _rq_first(rq);
+    if(!next && _steal_work())next = _rq_first(rq);
+    if(!next)return rq->idle;
+    _dequeue(rq, next);
+    return next;
 }
 
 static void update_this_proc(struct proc* p)
 {
     // TODO: if using simple_sched, you should implement this routinue
     // update thisproc to the choosen process, and reset the clock interrupt if need
-    cpus[cpuid()].sched.thisproc = p;
+    auto rq = this_rq();
+    rq->thisproc = p;
+    if(p->schinfo.wakeup_ts){
+        u64 latency = get_timestamp() - p->schinfo.wakeup_ts;
+        p->schinfo.wakeup_ts = 0;
+        rq->nr_wakeups++;
+        rq->wakeup_latency += latency;
+        rq->max_wakeup_latency = MAX(rq->max_wakeup_latency, latency);
+    }
+    if(!p->idle){
+        // restart the slice timer with the slice of p, a deadline
+        // process runs until its budget is used up
+        auto slice = &time_slice_timers[cpuid()];
+        int elapse = TIME_SLICE_LEN;
+        if(_is_dl(p))elapse = MAX(ticks_to_ms(p->schinfo.dl_budget), 1);
+#if SCHED_CFS
+        else elapse = _cfs_slice(rq, p);
+#endif
+        bool restart = SCHED_CFS || _is_dl(p) || elapse != slice->elapse;
+        if(restart && !slice->triggered){
+            cancel_cpu_timer(slice);
+            slice->triggered = true;
+        }
+        slice->elapse = elapse;
+        p->schinfo.exec_start = get_timestamp();
+    }
+    _update_tick(rq);
+}
+
+// called after switching to a process with the lock of this cpu held
+static void _finish_switch(){
+    auto rq = this_rq();
+    auto p = rq->migrating;
+    rq->migrating = NULL;
+    // p is asleep with its context saved, and nothing activates it while
+    // the lock of its old run queue is held
+    if(p)__atomic_store_n(&p->schinfo.cpu, rq->migrate_to, __ATOMIC_RELEASE);
+    _release_sched_lock();
+    if(p)activate_proc(p);
 }
 
-static int do_level_cpu;
 // A simple scheduler.
 // You are allowed to replace it with whatever you like.
 static void simple_sched(enum procstate new_state)
 {
-    // set level_up_timer
-    if(level_up_timer.triggered){
-        if(do_level_cpu == cpuid())set_cpu_timer(&level_up_timer);
-        do_level_cpu = (do_level_cpu + 1) % NCPU;
-    }
     auto this = thisproc();
     ASSERT(this->state == RUNNING);
-    if(this->killed && new_state != ZOMBIE){
+    // a migrating process is activated on its new cpu even if killed
+    if(this->killed && new_state != ZOMBIE && this_rq()->migrating != this){
         _release_sched_lock();
         return;
     }
@@ -227,21 +831,38 @@ static void simple_sched(enum procstate new_state)
     next->state = RUNNING;
     if (next != this)
     {
+        sched_trace(SCHED_EV_SWITCH, this, sched_trace_pid(next), new_state);
+        fpsimd_switch(this, next);
         swtch(next->kcontext, &this->kcontext);
     }
-    _release_sched_lock();
+    _finish_switch();
     if(thisproc()->pgdir.pt)attach_pgdir(&thisproc()->pgdir);
-    if(time_slice_timers[cpuid()].triggered)set_cpu_timer(&time_slice_timers[cpuid()]);
 }
 
 __attribute__((weak, alias("simple_sched"))) void _sched(enum procstate new_state);
 
 u64 proc_entry(void(*entry)(u64), u64 arg)
 {
-    _release_sched_lock();
+    _finish_switch();
     if(thisproc()->pgdir.pt)attach_pgdir(&thisproc()->pgdir);
     set_return_addr(entry);
-    if(time_slice_timers[cpuid()].triggered)set_cpu_timer(&time_slice_timers[cpuid()]);
     return arg;
 }
 
+void get_schedstat(struct schedstat* st)
+{
+    u64 latency = 0, max_latency = 0;
+    st->nr_wakeups = st->nr_ipis = 0;
+    for(int i = 0; i < NCPU; i++){
+        auto rq = &cpus[i].sched;
+        _acquire_spinlock(&rq->lock);
+        st->nr_wakeups += rq->nr_wakeups;
+        latency += rq->wakeup_latency;
+        max_latency = MAX(max_latency, rq->max_wakeup_latency);
+        _release_spinlock(&rq->lock);
+        st->nr_ipis += __atomic_load_n(&rq->nr_ipis, __ATOMIC_RELAXED);
+    }
+    u64 ticks_per_us = get_clock_frequency() / 1000000;
+    st->avg_wakeup_latency_ns = st->nr_wakeups ? latency * 1000 / ticks_per_us / st->nr_wakeups : 0;
+    st->max_wakeup_latency_ns = max_latency * 1000 / ticks_per_us;
+}
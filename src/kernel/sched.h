@@ -4,9 +4,11 @@
 
 void init_schinfo(struct schinfo*);
 
-bool _activate_proc(struct proc*, bool onalert);
-#define activate_proc(proc) _activate_proc(proc, false)
-#define alert_proc(proc) _activate_proc(proc, true)
+bool _activate_proc(struct proc*, bool onalert, bool sync);
+#define activate_proc(proc) _activate_proc(proc, false, false)
+#define alert_proc(proc) _activate_proc(proc, true, false)
+// the caller is about to sleep, let proc run on its cpu next
+#define activate_proc_sync(proc) _activate_proc(proc, false, true)
 WARN_RESULT bool is_zombie(struct proc*);
 WARN_RESULT bool is_unused(struct proc*);
 void _acquire_sched_lock();
@@ -17,3 +19,17 @@ void _sched(enum procstate new_state);
 #define yield() (_acquire_sched_lock(), _sched(RUNNABLE))
 
 WARN_RESULT struct proc* thisproc();
+// set the nice value of the current process, used by the cfs class
+void set_nice(int nice);
+// move the current process into the deadline class, it gets `runtime` ms
+// of cpu time before `deadline` ms in every `period` ms
+// runtime = 0 moves it back, return -1 if the bandwidth is not admitted
+int set_deadline(u64 runtime, u64 deadline, u64 period);
+
+struct schedstat {
+    u64 nr_wakeups;             // activations which have got a cpu
+    u64 avg_wakeup_latency_ns;  // from activate_proc to running
+    u64 max_wakeup_latency_ns;
+    u64 nr_ipis;                // reschedule IPIs sent
+};
+void get_schedstat(struct schedstat*);
@@ -0,0 +1,95 @@
+#include <kernel/schedtrace.h>
+#include <kernel/cpu.h>
+#include <kernel/init.h>
+#include <kernel/mem.h>
+#include <kernel/proc.h>
+#include <kernel/syscall.h>
+#include <aarch64/intrinsic.h>
+#include <common/spinlock.h>
+
+// Each cpu writes its own ring without locks: the kernel is not preemptive
+// and traps are masked in kernel mode, so there is one writer per ring.
+// Readers take `lock` to advance `tail`. A full ring drops new events.
+
+#define TRACE_PAGES 8
+#define TRACE_PER_PAGE (PAGE_SIZE / sizeof(struct sched_event))
+#define TRACE_SIZE (TRACE_PAGES * TRACE_PER_PAGE)
+
+struct trace_ring {
+    struct sched_event* pages[TRACE_PAGES];
+    u64 head;       // only written by the owner cpu
+    u64 tail;
+    u64 dropped;
+    SpinLock lock;  // for readers
+};
+
+bool sched_trace_on;
+static struct trace_ring rings[NCPU];
+
+#define _trace_slot(ring, i) (&(ring)->pages[(i) / TRACE_PER_PAGE][(i) % TRACE_PER_PAGE])
+
+define_init(sched_trace) {
+    for (int c = 0; c < NCPU; c++) {
+        init_spinlock(&rings[c].lock);
+        for (int i = 0; i < TRACE_PAGES; i++)
+            rings[c].pages[i] = kalloc_page();
+        rings[c].head = rings[c].tail = rings[c].dropped = 0;
+    }
+}
+
+void _sched_trace(u32 type, struct proc* p, i64 a0, i64 a1) {
+    int cpu = cpuid();
+    auto ring = &rings[cpu];
+    u64 head = ring->head;
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= TRACE_SIZE) {
+        ring->dropped++;
+        return;
+    }
+    auto ev = _trace_slot(ring, head % TRACE_SIZE);
+    ev->ts = get_timestamp();
+    ev->type = type;
+    ev->cpu = cpu;
+    ev->pid = sched_trace_pid(p);
+    ev->a0 = a0;
+    ev->a1 = a1;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+// take the oldest event of a ring, timestamps in ns
+static bool _trace_pop(struct trace_ring* ring, struct sched_event* ev) {
+    bool ok = false;
+    _acquire_spinlock(&ring->lock);
+    u64 tail = ring->tail;
+    if (tail != __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)) {
+        *ev = *_trace_slot(ring, tail % TRACE_SIZE);
+        __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+        ok = true;
+    }
+    _release_spinlock(&ring->lock);
+    if (ok)
+        ev->ts = ev->ts * 1000 / (get_clock_frequency() / 1000000);
+    return ok;
+}
+
+int sched_trace_ctl(int cmd, struct sched_event* buf, int n) {
+    switch (cmd) {
+        case SCHED_TRACE_STOP:
+        case SCHED_TRACE_START:
+            __atomic_store_n(&sched_trace_on, cmd == SCHED_TRACE_START, __ATOMIC_RELEASE);
+            return 0;
+        case SCHED_TRACE_READ:
+            break;
+        default:
+            return -1;
+    }
+    if (n < 0 || !user_writeable(buf, sizeof(struct sched_event) * n))
+        return -1;
+    int cnt = 0;
+    for (int c = 0; c < NCPU && cnt < n; c++) {
+        struct sched_event ev;
+        // copy outside the lock, writing user memory may fault
+        while (cnt < n && _trace_pop(&rings[c], &ev))
+            buf[cnt++] = ev;
+    }
+    return cnt;
+}
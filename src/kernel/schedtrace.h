@@ -0,0 +1,47 @@
+#pragma once
+
+#include <common/defines.h>
+
+struct proc;
+
+// compile the scheduler trace points in, they still do nothing but test a
+// flag until tracing is started
+#define SCHED_TRACE 1
+
+enum sched_event_type {
+    SCHED_EV_SWITCH = 1,    // pid switched out in state a1, a0 switched in
+    SCHED_EV_WAKEUP,        // pid woken by a0 onto cpu a1
+    SCHED_EV_MIGRATE,       // pid moved from cpu a0 to cpu a1
+    SCHED_EV_LEVEL,         // pid moved from level a0 to level a1
+};
+
+// the layout is shared with user/schedtrace
+struct sched_event {
+    u64 ts;     // ns since boot
+    u32 type;
+    u32 cpu;
+    i32 pid;    // -1 for the idle process
+    i32 _pad;
+    i64 a0, a1;
+};
+
+#define SCHED_TRACE_STOP 0
+#define SCHED_TRACE_START 1
+#define SCHED_TRACE_READ 2
+
+extern bool sched_trace_on;
+
+void _sched_trace(u32 type, struct proc* p, i64 a0, i64 a1);
+#if SCHED_TRACE
+#define sched_trace(type, p, a0, a1) \
+    do { if (__builtin_expect(sched_trace_on, 0)) _sched_trace(type, p, a0, a1); } while (0)
+#else
+#define sched_trace(type, p, a0, a1) do {} while (0)
+#endif
+
+// pid of p in trace events
+#define sched_trace_pid(p) ((p) == NULL || (p)->idle ? -1 : (p)->pid)
+
+// start/stop tracing, or move at most n events into the user buffer
+// return the number of events read, or -1
+int sched_trace_ctl(int cmd, struct sched_event* buf, int n);
@@ -1,14 +1,55 @@
 #pragma once
 
 #include <common/list.h>
+#include <common/rbtree.h>
 struct proc; // dont include proc.h here
 
+#define NLEVEL 3
+
+// use the fair-share (vruntime) class instead of mlfq
+#ifndef SCHED_CFS
+#define SCHED_CFS 0
+#endif
+
+#define NICE_MIN -20
+#define NICE_MAX 19
+
 // embedded data for cpus
 struct sched
 {
     // TODO: customize your sched info
     struct proc* thisproc;
     struct proc* idle;
+    // per-cpu mlfq, protected by `lock`
+    // only RUNNABLE processes are queued, bit i of `bitmap` is set iff
+    // mlfq[i] is not empty
+    SpinLock lock;
+    ListNode mlfq[NLEVEL];
+    u64 bitmap;
+    // cfs: processes ordered by vruntime, protected by `lock`
+    struct rb_root_ cfs_tree;
+    u64 min_vruntime;
+    // total weight of the processes in cfs_tree
+    u64 load;
+    // number of processes in mlfq or cfs_tree
+    int nr_ready;
+    // the time slice timer is not armed for the running process
+    bool tick_stopped;
+    // woken by a waker about to sleep on this cpu, run it next
+    struct proc* handoff;
+    // deadline class: ready processes ordered by absolute deadline, and
+    // throttled ones waiting for their next period, protected by `lock`
+    struct rb_root_ dl_tree;
+    ListNode dl_throttled;
+    // switched out to move to cpu migrate_to, activated there after the
+    // switch
+    struct proc* migrating;
+    int migrate_to;
+    // statistics of wakeups, latencies are in timer ticks
+    u64 nr_wakeups;
+    u64 wakeup_latency;
+    u64 max_wakeup_latency;
+    u64 nr_ipis;
 };
 
 // embeded data for procs
@@ -18,4 +59,23 @@ struct schinfo
     ListNode rq;
     i64 level;
     u64 left_time_slices;
+    // the cpu whose run queue owns this process
+    // only changed with the lock of that run queue held
+    int cpu;
+    // timestamp of the last activation, 0 if already accounted
+    u64 wakeup_ts;
+    // timestamp when the process got the cpu
+    u64 exec_start;
+    // cfs
+    struct rb_node_ cfs_node;
+    int nice;
+    u64 vruntime;
+    // deadline class, in timer ticks, dl_runtime is 0 for other classes
+    // a deadline process never leaves `cpu`, and its `rq` node links it
+    // into dl_throttled when it runs out of budget
+    struct rb_node_ dl_node;
+    u64 dl_runtime, dl_deadline, dl_period;
+    u64 dl_abs_deadline;
+    i64 dl_budget;
+    bool dl_throttled;
 };
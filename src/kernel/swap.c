@@ -0,0 +1,351 @@
+#include <kernel/swap.h>
+#include <aarch64/intrinsic.h>
+#include <common/buf.h>
+#include <common/sem.h>
+#include <common/spinlock.h>
+#include <common/string.h>
+#include <driver/sd.h>
+#include <kernel/mem.h>
+#include <kernel/paging.h>
+#include <kernel/printk.h>
+#include <kernel/proc.h>
+#include <kernel/pt.h>
+#include <kernel/sched.h>
+#include <kernel/tlb.h>
+
+// Swap slots are page sized runs of sectors on the swap partition. kswapd
+// picks victims with a clock over the heap and stack pages of all
+// processes: a page whose access flag is set gets a second chance and has
+// the flag cleared (the next access takes an access flag fault which sets
+// it again), a page whose flag is still clear when the hand comes back is
+// swapped out. Only pages which are not shared are taken.
+//
+// A victim is unmapped at once and written out afterwards without the page
+// table locked. Until the write completes the page stays in `writeback`,
+// where a fault on it finds it again without reading the disk.
+
+#define SECTORS_PER_SLOT (PAGE_SIZE / BSIZE)
+#define SWAP_MAX_SLOTS 8192
+// victims written out per round of kswapd
+#define SWAP_BATCH 16
+// ptes looked at per round
+#define SWAP_SCAN_LIMIT 1024
+
+struct swap_io {
+    int slot;
+    void* page;
+};
+
+static SpinLock swap_lock;
+static int nslots;
+// number of ptes referring to each slot
+static u8 slot_ref[SWAP_MAX_SLOTS];
+// being written, a slot is free if it has no reference and is not busy
+static bool slot_busy[SWAP_MAX_SLOTS];
+static int slot_hand;
+static struct swap_io writeback[SWAP_BATCH];
+static int nwriteback;
+static u64 used_slots, swap_outs, swap_ins;
+
+static struct proc* kswapd_proc;
+static bool kswapd_kicked;
+// page faults waiting for free pages
+static Semaphore pages_wait;
+
+// clock hand over the processes and their address spaces, hand_va is
+// HAND_DONE when the process at hand_pid is done
+#define HAND_DONE (~0ull)
+static int hand_pid = -1;
+static u64 hand_va = HAND_DONE;
+
+static void _swap_rw(int slot, void* page, bool write) {
+    buf b;
+    for (int i = 0; i < SECTORS_PER_SLOT; i++) {
+        b.blockno = P3_sLBA + (u32)slot * SECTORS_PER_SLOT + i;
+        if (write) {
+            b.flags = B_DIRTY | B_VALID;
+            memcpy(b.data, page + i * BSIZE, BSIZE);
+        } else
+            b.flags = 0;
+        sdrw(&b);
+        if (!write)
+            memcpy(page + i * BSIZE, b.data, BSIZE);
+    }
+}
+
+// swap_lock must be held
+static int _alloc_slot() {
+    for (int i = 0; i < nslots; i++) {
+        int s = (slot_hand + i) % nslots;
+        if (slot_ref[s] == 0 && !slot_busy[s]) {
+            slot_hand = s + 1;
+            slot_ref[s] = 1;
+            slot_busy[s] = true;
+            used_slots++;
+            return s;
+        }
+    }
+    return -1;
+}
+
+// swap_lock must be held
+static void _put_slot(int slot) {
+    if (slot_ref[slot] == 0 && !slot_busy[slot])
+        used_slots--;
+}
+
+void swap_dup(PTEntry pte) {
+    int slot = SWAP_SLOT(pte);
+    _acquire_spinlock(&swap_lock);
+    if (slot_ref[slot] == 255)
+        PANIC();
+    slot_ref[slot]++;
+    _release_spinlock(&swap_lock);
+}
+
+void swap_free(PTEntry pte) {
+    int slot = SWAP_SLOT(pte);
+    _acquire_spinlock(&swap_lock);
+    ASSERT(slot_ref[slot] > 0);
+    slot_ref[slot]--;
+    _put_slot(slot);
+    _release_spinlock(&swap_lock);
+}
+
+struct scan {
+    int nvictims;
+    int nscanned;
+    bool no_slot;
+    bool flush;     // of the process at hand
+};
+
+// the next anonymous section at or above `va`
+static struct section* _next_section(struct pgdir* pd, u64 va) {
+    struct section* ret = NULL;
+    _for_in_list(p, &pd->section_head) {
+        if (p == &pd->section_head)
+            continue;
+        auto sec = container_of(p, struct section, stnode);
+        if (sec->flags != ST_HEAP && sec->flags != ST_USER_STACK)
+            continue;
+        if (sec->end > va && (!ret || sec->begin < ret->begin))
+            ret = sec;
+    }
+    return ret;
+}
+
+// the clock hand at a page of the process at hand, stops the walk at the
+// end of a round. 2 MB blocks are not swapped
+static int _scan_pte(struct pt_walk* w, u64 va, PTEntriesPtr pte) {
+    struct scan* sc = w->arg;
+    if (sc->nvictims == SWAP_BATCH || sc->nscanned == SWAP_SCAN_LIMIT) {
+        hand_va = va;
+        return 1;
+    }
+    if (!(*pte & PTE_VALID))
+        return 0;
+    sc->nscanned++;
+    if (*pte & AF_USED) {
+        *pte &= ~(u64)AF_USED;
+        sc->flush = true;
+        return 0;
+    }
+    void* page = (void*)P2K(PTE_ADDRESS(*pte));
+    if (get_page_ref((u64)page) != 1)
+        return 0;
+    _acquire_spinlock(&swap_lock);
+    int slot = _alloc_slot();
+    if (slot >= 0) {
+        writeback[nwriteback++] = (struct swap_io){slot, page};
+        swap_outs++;
+    }
+    _release_spinlock(&swap_lock);
+    if (slot < 0) {
+        sc->no_slot = true;
+        hand_va = va;
+        return 1;
+    }
+    // the page reference of the mapping moves to writeback
+    *pte = SWAP_PTE(slot);
+    sc->flush = true;
+    sc->nvictims++;
+    return 0;
+}
+
+// advance the clock hand in the address space of p, the process tree is
+// locked so p is not freed
+static void _scan_proc(struct proc* p, void* arg) {
+    struct scan* sc = arg;
+    auto pd = &p->pgdir;
+    if (p->pid != hand_pid) {
+        hand_pid = p->pid;
+        hand_va = 0;
+    }
+    // skip a process which holds its lock, it may sleep with it
+    if (!_try_acquire_spinlock(&pd->lock)) {
+        hand_va = HAND_DONE;
+        return;
+    }
+    sc->flush = false;
+    // shared tables are skipped, their pages are shared
+    struct pt_walk w = {pd, false, NULL, NULL, _scan_pte, sc};
+    struct section* sec;
+    while (pd->pt && (sec = _next_section(pd, hand_va))) {
+        hand_va = MAX(hand_va, PAGE_BASE(sec->begin));
+        if (walk_range(&w, hand_va, sec->end))
+            goto out;
+        hand_va = sec->end;
+    }
+    hand_va = HAND_DONE;
+out:
+    if (sc->flush)
+        flush_tlb_pgdir(pd);
+    _release_spinlock(&pd->lock);
+}
+
+// write the victims out and free their pages
+static void _writeback() {
+    for (int i = 0; i < nwriteback; i++) {
+        // the entries only get removed here, by kswapd
+        _swap_rw(writeback[i].slot, writeback[i].page, true);
+        _acquire_spinlock(&swap_lock);
+        void* page = writeback[i].page;
+        int slot = writeback[i].slot;
+        writeback[i].page = NULL;
+        slot_busy[slot] = false;
+        _put_slot(slot);
+        _release_spinlock(&swap_lock);
+        kfree_page(page);
+    }
+    _acquire_spinlock(&swap_lock);
+    nwriteback = 0;
+    _release_spinlock(&swap_lock);
+}
+
+// sleep until kicked. swap_kick() is called by the page allocator, which may
+// run with the lock of any semaphore held, so it wakes kswapd directly: it
+// takes the lock of the run queue of kswapd, which is held here, and either
+// the flag is seen or kswapd is asleep when it is woken
+static void _kswapd_sleep() {
+    setup_checker(0);
+    lock_for_sched(0);
+    sched(0, __atomic_load_n(&kswapd_kicked, __ATOMIC_ACQUIRE) ? RUNNABLE : DEEPSLEEPING);
+}
+
+static void kswapd(u64 arg) {
+    (void)arg;
+    while (1) {
+        _kswapd_sleep();
+        if (!__atomic_load_n(&kswapd_kicked, __ATOMIC_ACQUIRE))
+            continue;
+        // give up after a whole turn of the clock without a victim, the
+        // turn before has cleared all access flags
+        int idle_turns = 0;
+        bool found = false;
+        while (left_page_cnt() < SWAP_HIGH_PAGES && idle_turns < 2) {
+            struct scan sc = {0, 0, false, false};
+            while (sc.nvictims < SWAP_BATCH && sc.nscanned < SWAP_SCAN_LIMIT
+                   && !sc.no_slot) {
+                int from = hand_va == HAND_DONE ? hand_pid : hand_pid - 1;
+                if (with_next_proc(from, _scan_proc, &sc) < 0) {
+                    hand_pid = -1;
+                    hand_va = HAND_DONE;
+                    idle_turns = found || sc.nvictims ? 0 : idle_turns + 1;
+                    found = false;
+                    break;
+                }
+            }
+            if (sc.nvictims)
+                found = true;
+            _writeback();
+            post_all_sem(&pages_wait);
+            if (sc.no_slot) {
+                printk("kswapd: out of swap space\n");
+                break;
+            }
+        }
+        __atomic_store_n(&kswapd_kicked, false, __ATOMIC_RELEASE);
+        post_all_sem(&pages_wait);
+    }
+}
+
+void swap_kick() {
+    if (kswapd_proc && !__atomic_exchange_n(&kswapd_kicked, true, __ATOMIC_ACQ_REL))
+        activate_proc(kswapd_proc);
+}
+
+void swap_wait_pages() {
+    if (!kswapd_proc || thisproc() == kswapd_proc)
+        return;
+    while (left_page_cnt() < SWAP_MIN_PAGES) {
+        _lock_sem(&pages_wait);
+        swap_kick();
+        // kswapd posts after every batch, and when it gives up
+        if (!_wait_sem(&pages_wait, false) || !__atomic_load_n(&kswapd_kicked, __ATOMIC_ACQUIRE))
+            break;
+    }
+}
+
+bool swap_in(struct pgdir* pd, u64 va) {
+    auto pte = get_pte(pd, va, false);
+    PTEntry entry = *pte;
+    int slot = SWAP_SLOT(entry);
+
+    // still being written out: take the page back, shared with writeback
+    _acquire_spinlock(&swap_lock);
+    for (int i = 0; i < nwriteback; i++) {
+        if (writeback[i].slot == slot && writeback[i].page) {
+            void* page = writeback[i].page;
+            kshare_page((u64)page);
+            slot_ref[slot]--;
+            _put_slot(slot);
+            swap_ins++;
+            _release_spinlock(&swap_lock);
+            *pte = K2P(page) | PTE_USER_DATA | PTE_RO;
+            return true;
+        }
+    }
+    _release_spinlock(&swap_lock);
+
+    _release_spinlock(&pd->lock);
+    swap_wait_pages();
+    void* page = kalloc_page();
+    _acquire_spinlock(&pd->lock);
+    if (!page)
+        return false;
+    _release_spinlock(&pd->lock);
+    _swap_rw(slot, page, false);
+    _acquire_spinlock(&pd->lock);
+    // the process is the only one to change its ptes
+    pte = get_pte(pd, va, false);
+    ASSERT(pte && *pte == entry);
+    *pte = K2P(page) | PTE_USER_DATA | PTE_RW;
+    swap_free(entry);
+    _acquire_spinlock(&swap_lock);
+    swap_ins++;
+    _release_spinlock(&swap_lock);
+    return true;
+}
+
+void get_swapstat(struct swapstat* st) {
+    _acquire_spinlock(&swap_lock);
+    st->slots = nslots;
+    st->used = used_slots;
+    st->swap_outs = swap_outs;
+    st->swap_ins = swap_ins;
+    _release_spinlock(&swap_lock);
+}
+
+void init_swap() {
+    init_spinlock(&swap_lock);
+    init_sem(&pages_wait, 0);
+    nslots = MIN(P3_num / SECTORS_PER_SLOT, (u32)SWAP_MAX_SLOTS);
+    if (nslots == 0) {
+        printk("swap: no swap partition\n");
+        return;
+    }
+    printk("swap: %d pages\n", nslots);
+    auto p = create_proc();
+    kswapd_proc = p;
+    start_proc(p, kswapd, 0);
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <aarch64/mmu.h>
+#include <common/defines.h>
+
+struct pgdir;
+
+// Anonymous (heap and user stack) pages can be swapped out to the third
+// partition of the SD card. A swapped out page is left in its page table
+// as an invalid entry holding the slot number.
+#define PTE_SWAPPED (1 << 2)
+#define SWAP_PTE(slot) (((u64)(slot) << 12) | PTE_SWAPPED)
+#define SWAP_SLOT(pte) ((int)((pte) >> 12))
+#define IS_SWAP_PTE(pte) (((pte) & (PTE_VALID | PTE_SWAPPED)) == PTE_SWAPPED)
+
+// kswapd is woken below SWAP_LOW_PAGES free pages and swaps out until there
+// are SWAP_HIGH_PAGES; page faults wait for it below SWAP_MIN_PAGES
+#define SWAP_MIN_PAGES 64
+#define SWAP_LOW_PAGES 256
+#define SWAP_HIGH_PAGES 512
+
+struct swapstat {
+    u64 slots;
+    u64 used;
+    u64 swap_outs;
+    u64 swap_ins;
+};
+
+void init_swap();
+// called by the page allocator when free pages run low
+void swap_kick();
+// wait until there are enough free pages to handle a page fault
+void swap_wait_pages();
+// fault the page at `va` back in, false if there is no memory for it.
+// pd->lock is held, and dropped while the page is read
+WARN_RESULT bool swap_in(struct pgdir *pd, u64 va);
+// another page table entry refers to the slot of `pte`
+void swap_dup(PTEntry pte);
+// a page table entry referring to a slot is removed
+void swap_free(PTEntry pte);
+void get_swapstat(struct swapstat *);
@@ -34,45 +34,32 @@ void syscall_entry(UserContext *context) {
 // user process
 bool user_readable(const void *start, usize size) {
     // TODO
-    bool ret = false;
-	_for_in_list(node, &thisproc()->pgdir.section_head){
-		if(node == &thisproc()->pgdir.section_head)continue;
-		auto st = container_of(node, struct section, stnode);
-		if(st->begin <= (u64)start && ((u64)start + size) <= st->end){
-			ret = true;
-            break;
-		}
-	}
-    return ret;
+    auto st = section_find(&thisproc()->pgdir, (u64)start);
+    return st && ((u64)start + size) <= st->end;
 }
 
 // check if the virtual address [start,start+size) is READABLE & WRITEABLE by
 // the current user process
 bool user_writeable(const void *start, usize size) {
     // TODO
-    bool ret = false;
-	_for_in_list(node, &thisproc()->pgdir.section_head){
-		if(node == &thisproc()->pgdir.section_head)continue;
-		auto st = container_of(node, struct section, stnode);
-        if(st->flags == ST_TEXT)continue;
-		if(st->begin <= (u64)start && ((u64)start + size) <= st->end){
-			ret = true;
-            break;
-		}
-	}
-    return ret;
+    auto st = section_find(&thisproc()->pgdir, (u64)start);
+    return st && st->flags != ST_TEXT && ((u64)start + size) <= st->end;
 }
 
 // get the length of a string including tailing '\0' in the memory space of
 // current user process return 0 if the length exceeds maxlen or the string is
 // not readable by the current user process
 usize user_strlen(const char *str, usize maxlen) {
+    struct section *st = NULL;
     for (usize i = 0; i < maxlen; i++) {
-        if (user_readable(&str[i], 1)) {
-            if (str[i] == 0)
-                return i + 1;
-        } else
-            return 0;
+        // look the section up again only when leaving it
+        if (!st || (u64)&str[i] >= st->end) {
+            st = section_find(&thisproc()->pgdir, (u64)&str[i]);
+            if (!st)
+                return 0;
+        }
+        if (str[i] == 0)
+            return i + 1;
     }
     return 0;
 }
\ No newline at end of file
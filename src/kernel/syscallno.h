@@ -4,6 +4,15 @@
 
 #define SYS_myreport 499
 #define SYS_pstat 500
+#define SYS_schedstat 501
+#define SYS_setdeadline 502
+#define SYS_schedtrace 503
+#define SYS_kmemstat 504
+#define SYS_zerostat 505
+#define SYS_swapstat 506
+#define SYS_hugestat 507
+#define SYS_tlbstat 508
+#define SYS_spawn 509
 #define SYS_sbrk 12
 
 #define SYS_clone 220
@@ -23,6 +23,7 @@
 #include <kernel/printk.h>
 #include <kernel/proc.h>
 #include <kernel/sched.h>
+#include <kernel/tlb.h>
 
 struct iovec {
     void *iov_base; /* Starting address. */
@@ -41,17 +42,11 @@ define_syscall(ioctl, int fd, u64 request) {
 void get_free_vm(struct pgdir* pd, u64 length, u64* begin, u64* end){
     // get vm area between heap and userstack section
     // a file must auto-mmapped at the top of the area
-    *end = (u64)-1;
-    _for_in_list(p, &pd->section_head){
-        if(p != &pd->section_head){
-            auto st = container_of(p, struct section, stnode);
-            if(st->flags == ST_HEAP)*begin = st->end;
-            if(st->flags == ST_MMAP_PRIVATE 
-                || st->flags == ST_MMAP_SHARED
-                || st->flags == ST_USER_STACK)*end = MIN(*end, st->begin);
-        }
-    }
-    if(*end - *begin < length){
+    *begin = pd->heap->end;
+    // the section after the heap is the lowest mmap or the stack
+    auto next = section_next(pd->heap);
+    *end = next ? next->begin : (u64)-1;
+    if(*end < *begin || *end - *begin < length){
         // to fix
         *begin = *end = 0;
     }
@@ -63,19 +58,21 @@ define_syscall(mmap, void *addr, int length, int prot, int flags, int fd,
                int offset) {
     // TODO
     if(prot == PROT_NONE || prot&PROT_EXEC || fd < 0 || fd >= NOFILE || length <= 0)return -1;
-    auto st = (struct section*)kalloc(sizeof(struct section));
+    // pages of the page cache are mapped directly
+    if(VA_OFFSET(addr) || offset < 0 || VA_OFFSET(offset))return -1;
+    auto st = (struct section*)kmem_cache_alloc(section_cache);
     memset(st, 0, sizeof(struct section));
     st->flags = flags == MAP_SHARED ? ST_MMAP_SHARED : ST_MMAP_PRIVATE;
 
     auto this = thisproc();
     auto f = fd2file(fd);
     if(!f){
-        kfree(st);
+        kmem_cache_free(section_cache, st);
         return -1;
     }
 
     if((prot & PROT_WRITE) && !f->writable && flags != MAP_PRIVATE){
-        kfree(st);
+        kmem_cache_free(section_cache, st);
         return -1;
     }
 
@@ -87,31 +84,31 @@ define_syscall(mmap, void *addr, int length, int prot, int flags, int fd,
         get_free_vm(&this->pgdir, length, &free_begin, &free_end);
         if(free_end == free_begin){
             // can not find an area
-            kfree(st);
+            kmem_cache_free(section_cache, st);
+            _release_spinlock(&this->pgdir.lock);
+            return -1;
+        }
+        st->begin = PAGE_BASE(free_end - (u64)length);
+        st->end = st->begin + (u64)length;
+        if(st->begin < free_begin){
+            kmem_cache_free(section_cache, st);
             _release_spinlock(&this->pgdir.lock);
             return -1;
         }
-        st->end = free_end;
-        st->begin = st->end - (u64)length;
     }
     else{
-        _for_in_list(p, &this->pgdir.section_head){
-            if(p != &this->pgdir.section_head){
-                auto sec = container_of(p, struct section, stnode);
-                if(sec->begin < (u64)addr + (u64)length && (u64)addr < sec->end){
-                    kfree(st);
-                    _release_spinlock(&this->pgdir.lock);
-                    return -1;
-                }
-            }
+        if(section_overlap(&this->pgdir, (u64)addr, (u64)addr + (u64)length)){
+            kmem_cache_free(section_cache, st);
+            _release_spinlock(&this->pgdir.lock);
+            return -1;
         }
         st->begin = (u64)addr;
         st->end = st->begin + (u64)length;
     }
     st->length = (u64)length;
     st->offset = (int)offset;
-    _insert_into_list(&this->pgdir.section_head, &st->stnode);
     st->prot = prot;
+    section_insert(&this->pgdir, st);
     _release_spinlock(&this->pgdir.lock);
     return st->begin;
 }
@@ -121,42 +118,26 @@ define_syscall(munmap, void *addr, u64 length) {
     // TODO
     auto this = thisproc();
     _acquire_spinlock(&this->pgdir.lock);
-    _for_in_list(p, &this->pgdir.section_head){
-        if(p != &this->pgdir.section_head){
-            auto st = container_of(p, struct section, stnode);
-            if((u64)addr == st->begin){
-                ASSERT(st->flags == ST_MMAP_PRIVATE || st->flags == ST_MMAP_SHARED);
-                ASSERT(st->fp);
-                if(length >= st->end - st->begin){
-                    free_section_pages(&this->pgdir, st);
-                    _detach_from_list(p);
-                    file_close(st->fp);
-                    kfree(st);
-                }
-                else {
-                    auto end = st->begin + length;
-                    for(auto i = PAGE_BASE(st->begin); i < end; i += PAGE_SIZE){
-                        auto pte = get_pte(&this->pgdir, i, false);
-                        if(st->fp->type == FD_INODE && get_page_ref(P2K(PTE_ADDRESS(*pte))) == 1){
-                            u64 this_begin = MAX(i, st->begin);
-                            u64 this_end = MIN(i + PAGE_SIZE, end);
-                            st->fp->off = st->offset + this_begin - st->begin;
-                            file_write(st->fp, (char*)P2K(PTE_ADDRESS(*pte)), MIN((u64)PAGE_SIZE, this_end - this_begin));
-                        }
-                        else if(st->fp->type == FD_PIPE){
-                            // TODO
-                            PANIC();
-                        }
-                        else PANIC();
-                        kfree_page((void*)P2K(PTE_ADDRESS(*pte)));
-                        *pte = NULL;
-                    }
-                    st->begin = end;
-                }
-                break;
-            }
+    auto st = section_find(&this->pgdir, (u64)addr);
+    struct tlb_gather tlb;
+    tlb_gather_init(&tlb, &this->pgdir, false);
+    if(st && (u64)addr == st->begin){
+        ASSERT(st->flags == ST_MMAP_PRIVATE || st->flags == ST_MMAP_SHARED);
+        ASSERT(st->fp);
+        if(length >= st->end - st->begin){
+            free_section_pages(&tlb, st);
+            section_remove(&this->pgdir, st);
+            file_close(st->fp);
+            kmem_cache_free(section_cache, st);
+        }
+        else {
+            auto end = MIN(PAGE_BASE(st->begin + length + PAGE_SIZE - 1), st->end);
+            free_section_range(&tlb, st, st->begin, end);
+            st->offset += end - st->begin;
+            section_resize(&this->pgdir, st, end, st->end);
         }
     }
+    tlb_gather_finish(&tlb);
     _release_spinlock(&this->pgdir.lock);
     return 0;
 }
@@ -2,8 +2,12 @@
 #include <kernel/sched.h>
 #include <kernel/printk.h>
 #include <kernel/proc.h>
+#include <kernel/pt.h>
 #include <kernel/mem.h>
 #include <kernel/paging.h>
+#include <kernel/schedtrace.h>
+#include <kernel/swap.h>
+#include <kernel/tlb.h>
 
 define_syscall(gettid) {
     return thisproc()->pid;
@@ -36,12 +40,78 @@ define_syscall(pstat) {
     return (u64)left_page_cnt();
 }
 
+define_syscall(setpriority, int which, int who, int prio) {
+    if (which != 0 || (who != 0 && who != thisproc()->pid))
+        return -1;
+    set_nice(prio);
+    return 0;
+}
+
+define_syscall(getpriority, int which, int who) {
+    if (which != 0 || (who != 0 && who != thisproc()->pid))
+        return -1;
+    // the raw syscall returns 20 - nice
+    return 20 - thisproc()->schinfo.nice;
+}
+
+define_syscall(setdeadline, u64 runtime, u64 deadline, u64 period) {
+    return set_deadline(runtime, deadline, period);
+}
+
+define_syscall(schedstat, struct schedstat* st) {
+    if (!user_writeable(st, sizeof(struct schedstat)))
+        return -1;
+    get_schedstat(st);
+    return 0;
+}
+
+define_syscall(schedtrace, int cmd, struct sched_event* buf, int n) {
+    return sched_trace_ctl(cmd, buf, n);
+}
+
+define_syscall(kmemstat, struct kmem_cache_stat* st, int n) {
+    if (n < 0 || !user_writeable(st, n * sizeof(struct kmem_cache_stat)))
+        return -1;
+    return get_kmem_cache_stats(st, n);
+}
+
+define_syscall(zerostat, struct zero_pool_stat* st) {
+    if (!user_writeable(st, sizeof(struct zero_pool_stat)))
+        return -1;
+    get_zero_pool_stat(st);
+    return 0;
+}
+
+define_syscall(swapstat, struct swapstat* st) {
+    if (!user_writeable(st, sizeof(struct swapstat)))
+        return -1;
+    get_swapstat(st);
+    return 0;
+}
+
+define_syscall(hugestat, struct hugestat* st) {
+    if (!user_writeable(st, sizeof(struct hugestat)))
+        return -1;
+    get_hugestat(st);
+    return 0;
+}
+
+define_syscall(tlbstat, struct tlbstat* st) {
+    if (!user_writeable(st, sizeof(struct tlbstat)))
+        return -1;
+    get_tlbstat(st);
+    return 0;
+}
+
 define_syscall(sbrk, i64 size) {
     return sbrk(size);
 }
 
 define_syscall(clone, int flag, void* childstk) {
     if(childstk){}
+    // vfork() of musl is CLONE_VM | CLONE_VFORK | SIGCHLD
+    if (flag == 0x4111)
+        return vfork();
     if (flag != 17) {
         printk("sys_clone: flags other than SIGCHLD are not supported.\n");
         return -1;
@@ -68,6 +138,14 @@ define_syscall(execve, const char* p, void* argv, void* envp) {
     return execve(p, argv, envp);
 }
 
+define_syscall(spawn, const char* p, void* argv, void* envp,
+               const struct spawn_action* actions, int nactions) {
+    if (!user_strlen(p, 256) || nactions < 0 || nactions > NOFILE
+        || (nactions && !user_readable(actions, sizeof(struct spawn_action) * nactions)))
+        return -1;
+    return spawn(p, argv, envp, actions, nactions);
+}
+
 define_syscall(wait4, int pid, int options, int* wstatus, void* rusage) {
     if (pid != -1 || wstatus != 0 || options != 0 || rusage != 0) {
         printk("sys_wait4: unimplemented. pid %d, wstatus 0x%p, options 0x%x, rusage 0x%p\n",
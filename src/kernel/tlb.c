@@ -0,0 +1,207 @@
+#include <kernel/tlb.h>
+#include <aarch64/intrinsic.h>
+#include <common/spinlock.h>
+#include <common/string.h>
+#include <kernel/cpu.h>
+#include <kernel/init.h>
+#include <kernel/mem.h>
+#include <kernel/pt.h>
+
+// ASID 0 is the one of invalid_pt and is never handed out. A cpu switching
+// to an address space whose ASID is of the current generation only
+// publishes it in active_asid, everything else is done under asid_lock.
+
+static SpinLock asid_lock;
+static u64 asid_generation = NUM_ASIDS;
+static bool asid_used[NUM_ASIDS];
+static u64 asid_hand = 1;
+// the ASID running on each cpu, 0 when a rollover has taken it away
+static u64 active_asid[NCPU];
+// the ASID each cpu ran at the last rollover, kept for its address space
+static u64 reserved_asid[NCPU];
+static bool flush_pending[NCPU];
+static u64 rollovers;
+
+static struct {
+    u64 full, asid, page, switches;
+} tlb_count[NCPU];
+
+define_early_init(asid) {
+    init_spinlock(&asid_lock);
+    asid_used[0] = true;
+}
+
+// asid_lock must be held
+static void _rollover() {
+    asid_generation += NUM_ASIDS;
+    memset(asid_used, 0, sizeof(asid_used));
+    asid_used[0] = true;
+    for (int i = 0; i < NCPU; i++) {
+        u64 asid = __atomic_exchange_n(&active_asid[i], 0, __ATOMIC_RELAXED);
+        // a cpu which has not switched since the last rollover still runs
+        // its reserved ASID
+        if (asid == 0)
+            asid = reserved_asid[i];
+        asid_used[ASID(asid)] = true;
+        reserved_asid[i] = asid;
+        flush_pending[i] = true;
+    }
+    rollovers++;
+}
+
+// keep `asid` if it is reserved, asid_lock must be held
+static bool _update_reserved(u64 asid, u64 new_asid) {
+    bool hit = false;
+    for (int i = 0; i < NCPU; i++) {
+        if (reserved_asid[i] == asid) {
+            reserved_asid[i] = new_asid;
+            hit = true;
+        }
+    }
+    return hit;
+}
+
+// asid_lock must be held
+static u64 _new_asid(u64 asid) {
+    if (asid) {
+        u64 new_asid = asid_generation | ASID(asid);
+        if (_update_reserved(asid, new_asid))
+            return new_asid;
+        if (!asid_used[ASID(asid)]) {
+            asid_used[ASID(asid)] = true;
+            return new_asid;
+        }
+    }
+    for (int pass = 0; pass < 2; pass++) {
+        for (u64 i = 0; i < NUM_ASIDS; i++) {
+            u64 n = (asid_hand + i) % NUM_ASIDS;
+            if (!asid_used[n]) {
+                asid_used[n] = true;
+                asid_hand = n + 1;
+                return asid_generation | n;
+            }
+        }
+        _rollover();
+    }
+    PANIC();
+}
+
+u64 asid_switch(struct pgdir* pd) {
+    int cpu = cpuid();
+    tlb_count[cpu].switches++;
+    u64 asid = __atomic_load_n(&pd->asid, __ATOMIC_RELAXED);
+    u64 active = __atomic_load_n(&active_asid[cpu], __ATOMIC_RELAXED);
+    // a rollover clears active_asid first, then the exchange fails
+    if (active
+        && !((asid ^ __atomic_load_n(&asid_generation, __ATOMIC_RELAXED)) >> ASID_BITS)
+        && __atomic_compare_exchange_n(&active_asid[cpu], &active, asid, false,
+                                       __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        return ASID(asid);
+
+    _acquire_spinlock(&asid_lock);
+    asid = pd->asid;
+    if ((asid ^ asid_generation) >> ASID_BITS) {
+        asid = _new_asid(asid);
+        __atomic_store_n(&pd->asid, asid, __ATOMIC_RELAXED);
+    }
+    if (flush_pending[cpu]) {
+        flush_pending[cpu] = false;
+        arch_tlbi_vmalle1();
+        tlb_count[cpu].full++;
+    }
+    __atomic_store_n(&active_asid[cpu], asid, __ATOMIC_RELAXED);
+    _release_spinlock(&asid_lock);
+    return ASID(asid);
+}
+
+// a pgdir without an ASID has never been run, so nothing of it is cached
+
+void flush_tlb_page(struct pgdir* pd, u64 va) {
+    u64 asid = ASID(__atomic_load_n(&pd->asid, __ATOMIC_RELAXED));
+    if (asid == 0)
+        return;
+    arch_tlbi_vae1is(asid, va);
+    tlb_count[cpuid()].page++;
+}
+
+void flush_tlb_pgdir(struct pgdir* pd) {
+    u64 asid = ASID(__atomic_load_n(&pd->asid, __ATOMIC_RELAXED));
+    if (asid == 0)
+        return;
+    arch_tlbi_aside1is(asid);
+    tlb_count[cpuid()].asid++;
+}
+
+void get_tlbstat(struct tlbstat* st) {
+    memset(st, 0, sizeof(*st));
+    st->timestamp = get_timestamp();
+    st->freq = get_clock_frequency();
+    for (int i = 0; i < NCPU; i++) {
+        st->full += tlb_count[i].full;
+        st->asid += tlb_count[i].asid;
+        st->page += tlb_count[i].page;
+        st->switches += tlb_count[i].switches;
+    }
+    _acquire_spinlock(&asid_lock);
+    st->rollovers = rollovers;
+    _release_spinlock(&asid_lock);
+}
+
+void tlb_gather_init(struct tlb_gather* tlb, struct pgdir* pd, bool fullmm) {
+    tlb->pd = pd;
+    tlb->fullmm = fullmm;
+    tlb->all = false;
+    tlb->nvas = tlb->npages = 0;
+}
+
+void tlb_gather_va(struct tlb_gather* tlb, u64 va) {
+    if (tlb->fullmm || tlb->all)
+        return;
+    if (tlb->nvas == TLB_GATHER_VAS) {
+        tlb->all = true;
+        return;
+    }
+    tlb->vas[tlb->nvas++] = va;
+}
+
+void tlb_gather_all(struct tlb_gather* tlb) {
+    if (!tlb->fullmm)
+        tlb->all = true;
+}
+
+static void _gather(struct tlb_gather* tlb, u64 va, void* page, bool block) {
+    tlb_gather_va(tlb, va);
+    if (tlb->npages == TLB_GATHER_PAGES)
+        tlb_flush(tlb);
+    tlb->blocks[tlb->npages] = block;
+    tlb->pages[tlb->npages++] = page;
+}
+
+void tlb_gather_page(struct tlb_gather* tlb, u64 va, void* page) {
+    _gather(tlb, va, page, false);
+}
+
+void tlb_gather_block(struct tlb_gather* tlb, u64 va, void* block) {
+    _gather(tlb, va, block, true);
+}
+
+void tlb_flush(struct tlb_gather* tlb) {
+    if (tlb->all)
+        flush_tlb_pgdir(tlb->pd);
+    else
+        for (int i = 0; i < tlb->nvas; i++)
+            flush_tlb_page(tlb->pd, tlb->vas[i]);
+    // a single page is freed as one even if it was split from a block
+    for (int i = 0; i < tlb->npages; i++) {
+        if (tlb->blocks[i])
+            kfree_pages(tlb->pages[i]);
+        else
+            kfree_page(tlb->pages[i]);
+    }
+    tlb->all = false;
+    tlb->nvas = tlb->npages = 0;
+}
+
+void tlb_gather_finish(struct tlb_gather* tlb) {
+    tlb_flush(tlb);
+}
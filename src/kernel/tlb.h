@@ -0,0 +1,68 @@
+#pragma once
+
+#include <common/defines.h>
+
+struct pgdir;
+
+// User mappings are not global and are tagged with the ASID of their
+// address space, so switching address spaces does not flush the TLB and a
+// changed mapping is flushed by its address and ASID only.
+//
+// pgdir->asid holds a generation in its upper bits and the ASID in the low
+// ASID_BITS. When all ASIDs of a generation are handed out the generation
+// rolls over: the ASIDs running on the cpus are kept, the others are free
+// again and every cpu flushes its whole TLB before it runs a new one.
+#define ASID_BITS 8
+#define NUM_ASIDS (1 << ASID_BITS)
+#define ASID_MASK (NUM_ASIDS - 1)
+#define ASID(asid) ((asid) & ASID_MASK)
+
+struct tlbstat {
+    u64 timestamp;  // get_timestamp() when taken
+    u64 freq;       // of the timestamp, to turn the counts into rates
+    u64 full;       // whole TLB flushes
+    u64 asid;       // flushes of an address space
+    u64 page;       // flushes of a page
+    u64 rollovers;  // ASID generations used up
+    u64 switches;   // address space switches
+};
+
+// Range operations gather the translations they change and flush them once
+// at the end, each page if there are few of them, else the whole ASID. The
+// pages they unmap are freed after the flush, until then another cpu may
+// still reach them through its TLB.
+#define TLB_GATHER_VAS 16
+#define TLB_GATHER_PAGES 32
+
+struct tlb_gather {
+    struct pgdir *pd;
+    // the address space goes away with its ASID, nothing is flushed
+    bool fullmm;
+    bool all;   // more than TLB_GATHER_VAS translations changed
+    int nvas, npages;
+    u64 vas[TLB_GATHER_VAS];
+    void *pages[TLB_GATHER_PAGES];
+    bool blocks[TLB_GATHER_PAGES];  // pages[i] is a block of kalloc_pages()
+};
+
+// the ASID to run `pd` with on this cpu
+u64 asid_switch(struct pgdir *pd);
+// flush the translation of user address `va` in `pd` on all cpus
+void flush_tlb_page(struct pgdir *pd, u64 va);
+// flush all translations of `pd` on all cpus
+void flush_tlb_pgdir(struct pgdir *pd);
+void get_tlbstat(struct tlbstat *);
+
+// `fullmm` if all of `pd` is freed, see free_pgdir
+void tlb_gather_init(struct tlb_gather *tlb, struct pgdir *pd, bool fullmm);
+// the translation of user address `va` changed
+void tlb_gather_va(struct tlb_gather *tlb, u64 va);
+// the translations of all of tlb->pd may have changed
+void tlb_gather_all(struct tlb_gather *tlb);
+// `va` no longer maps `page`, a page from kalloc_page()
+void tlb_gather_page(struct tlb_gather *tlb, u64 va, void *page);
+// `va` no longer maps `block`, a block from kalloc_pages()
+void tlb_gather_block(struct tlb_gather *tlb, u64 va, void *block);
+// flush the gathered translations and free the pages
+void tlb_flush(struct tlb_gather *tlb);
+void tlb_gather_finish(struct tlb_gather *tlb);
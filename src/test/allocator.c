@@ -100,3 +100,113 @@ void alloc_test() {
     SYNC(6)
     if (cpuid() == 0) printk("alloc_test PASS\n");
 }
+
+static RefCount bench_x;
+static u64 bench_ticks[4];
+
+#define BENCH_SYNC(i)                                                          \
+    arch_dsb_sy();                                                             \
+    _increment_rc(&bench_x);                                                   \
+    while (bench_x.count < 4 * i)                                              \
+        ;                                                                      \
+    arch_dsb_sy();
+
+#define BENCH_ROUNDS 200
+#define BENCH_BATCH 256
+
+// page allocation throughput with 1, 2 and 4 cpus allocating at once
+void alloc_bench() {
+    static void* q[4][BENCH_BATCH];
+    int i = cpuid(), step = 0;
+    if (i == 0) printk("alloc_bench\n");
+    for (int ncpu = 1; ncpu <= 4; ncpu *= 2) {
+        BENCH_SYNC(++step)
+        if (i < ncpu) {
+            u64 t0 = get_timestamp();
+            for (int r = 0; r < BENCH_ROUNDS; r++) {
+                for (int j = 0; j < BENCH_BATCH; j++)
+                    if (!(q[i][j] = kalloc_page()))
+                        FAIL("FAIL: alloc_page() = NULL\n");
+                for (int j = 0; j < BENCH_BATCH; j++)
+                    kfree_page(q[i][j]);
+            }
+            bench_ticks[i] = get_timestamp() - t0;
+        }
+        BENCH_SYNC(++step)
+        if (i == 0) {
+            u64 ticks = 0;
+            for (int c = 0; c < ncpu; c++)
+                ticks = MAX(ticks, bench_ticks[c]);
+            u64 ms = MAX(ticks * 1000 / get_clock_frequency(), 1ull);
+            printk("%d cpu(s): %llu pages/s per core\n", ncpu,
+                   (u64)BENCH_ROUNDS * BENCH_BATCH * 1000 / ms);
+        }
+    }
+    BENCH_SYNC(++step)
+    if (i == 0) printk("alloc_bench PASS\n");
+}
+
+// contiguous allocations of every order, then check they all coalesce back
+// (order 0 goes through the per-cpu magazines and is covered by alloc_test)
+void buddy_test() {
+    static void* q[BUDDY_MAX_ORDER + 1][4];
+    struct buddystat before, after;
+    printk("buddy_test\n");
+    get_buddystat(&before);
+    for (int o = 1; o <= BUDDY_MAX_ORDER; o++) {
+        for (int j = 0; j < 4; j++) {
+            void* b = q[o][j] = kalloc_pages(o);
+            if (!b || (K2P(b) & ((PAGE_SIZE << o) - 1)))
+                FAIL("FAIL: kalloc_pages(%d) = %p\n", o, b);
+            memset(b, o ^ j, PAGE_SIZE << o);
+        }
+    }
+    for (int o = BUDDY_MAX_ORDER; o >= 1; o--) {
+        for (int j = 0; j < 4; j++) {
+            u8 m = (o ^ j) & 255;
+            for (u64 k = 0; k < ((u64)PAGE_SIZE << o); k += 509)
+                if (((u8*)q[o][j])[k] != m)
+                    FAIL("FAIL: block of order %d wrong\n", o);
+            kfree_pages(q[o][j]);
+        }
+    }
+    get_buddystat(&after);
+    if (after.free_pages != before.free_pages ||
+        after.largest_order != before.largest_order)
+        FAIL("FAIL: free pages %llu -> %llu\n", before.free_pages, after.free_pages);
+    for (int o = 0; o <= BUDDY_MAX_ORDER; o++)
+        printk("order %d: %llu free, %llu.%llu%% unusable\n", o,
+               after.nr_free[o], after.unusable[o] / 10, after.unusable[o] % 10);
+    printk("buddy_test PASS\n");
+}
+
+static void _kmem_test_ctor(void* p) {
+    ((u64*)p)[0] = 0x5a5a;
+    ((u64*)p)[1] = (u64)p;
+}
+
+// objects of a cache come out constructed, also after a round trip through
+// the slabs, then print the statistics of every cache
+void kmem_cache_test() {
+    static struct kmem_cache* cache;
+    static void* q[256];
+    printk("kmem_cache_test\n");
+    if (!cache)
+        cache = kmem_cache_create("kmem-test", 40, _kmem_test_ctor);
+    for (int round = 0; round < 2; round++) {
+        for (int i = 0; i < 256; i++) {
+            u64* p = q[i] = kmem_cache_alloc(cache);
+            if (!p || p[0] != 0x5a5a || p[1] != (u64)p)
+                FAIL("FAIL: object %d of round %d not constructed\n", i, round);
+        }
+        for (int i = 0; i < 256; i++)
+            kmem_cache_free(cache, q[i]);
+    }
+    static struct kmem_cache_stat st[32];
+    int n = get_kmem_cache_stats(st, 32);
+    for (int i = 0; i < n; i++)
+        printk("%s: size %llu, %llu in use, %llu slabs, %llu%% hit\n", st[i].name,
+               st[i].size, st[i].inuse, st[i].slabs,
+               st[i].allocs ? st[i].hits * 100 / st[i].allocs : 0);
+    printk("kmem_cache_test PASS\n");
+}
@@ -0,0 +1,75 @@
+#include <aarch64/intrinsic.h>
+#include <kernel/mem.h>
+#include <kernel/paging.h>
+#include <kernel/printk.h>
+#include <kernel/proc.h>
+#include <kernel/pt.h>
+#include <kernel/sched.h>
+#include <test/test.h>
+
+// random reads over a 32 MB heap mapped by pages and then by 2 MB blocks,
+// which is TLB bound with pages. Runs in a kernel process whose heap starts
+// at 0, like pgfault_first_test.
+
+#define BENCH_HEAP (32 * 1024 * 1024)
+#define BENCH_READS 1000000
+#define FAIL(...)                                                              \
+    {                                                                          \
+        printk(__VA_ARGS__);                                                   \
+        while (1)                                                              \
+            ;                                                                  \
+    }
+
+static u64 run(u64 heap) {
+    u64 sum = 0;
+    u64 t0 = get_timestamp();
+    for (int i = 0; i < BENCH_READS; i++) {
+        u64 va = heap + ((u64)rand() * RAND_MAX + rand()) % (BENCH_HEAP / 8) * 8;
+        sum += *(volatile u64*)va;
+    }
+    u64 t = get_timestamp() - t0;
+    if (sum == 0)
+        FAIL("FAIL: heap not written\n");
+    return t;
+}
+
+void huge_bench() {
+    struct pgdir* pd = &thisproc()->pgdir;
+    ASSERT(pd->pt);
+    attach_pgdir(pd);
+    printk("huge_bench\n");
+    u64 pc = left_page_cnt();
+    u64 t[2];
+    for (int huge = 0; huge < 2; huge++) {
+        struct hugestat st0, st;
+        huge_pages = huge;
+        get_hugestat(&st0);
+        u64 heap = sbrk(BENCH_HEAP);
+        for (u64 va = heap; va < heap + BENCH_HEAP; va += PAGE_SIZE)
+            *(u64*)va = va;
+        get_hugestat(&st);
+        if (st.live - st0.live != (huge ? BENCH_HEAP / HUGE_PAGE_SIZE : 0))
+            FAIL("FAIL: %llu blocks mapped\n", st.live - st0.live);
+        t[huge] = run(heap);
+        if (huge) {
+            // split the last block, the rest of it keeps its content
+            sbrk(-HUGE_PAGE_SIZE / 2);
+            get_hugestat(&st);
+            if (st.splits == st0.splits)
+                FAIL("FAIL: block not split\n");
+            u64 end = heap + BENCH_HEAP - HUGE_PAGE_SIZE / 2;
+            for (u64 va = end - HUGE_PAGE_SIZE / 2; va < end; va += PAGE_SIZE)
+                if (*(u64*)va != va)
+                    FAIL("FAIL: split lost %llx\n", va);
+            sbrk(-(BENCH_HEAP - HUGE_PAGE_SIZE / 2));
+        } else
+            sbrk(-BENCH_HEAP);
+        // page tables stay allocated
+        if (left_page_cnt() + 64 < pc)
+            FAIL("FAIL: %llu pages leaked\n", pc - left_page_cnt());
+    }
+    huge_pages = true;
+    printk("%d random reads: pages %llu ticks, blocks %llu ticks\n",
+           BENCH_READS, t[0], t[1]);
+    printk("huge_bench PASS\n");
+}
@@ -0,0 +1,61 @@
+#include <aarch64/intrinsic.h>
+#include <common/rc.h>
+#include <common/sem.h>
+#include <kernel/printk.h>
+#include <kernel/proc.h>
+#include <kernel/sched.h>
+#include <test/test.h>
+
+void set_parent_to_this(struct proc* proc);
+
+// every worker yields BENCH_ROUNDS times, so the cost of one switch is
+// measured with n runnable processes competing for the cpus
+#define BENCH_ROUNDS 100
+
+static Semaphore bench_start;
+static RefCount bench_ready;
+
+static void bench_worker(u64 rounds) {
+    _increment_rc(&bench_ready);
+    unalertable_wait_sem(&bench_start);
+    for (u64 i = 0; i < rounds; i++)
+        yield();
+    exit(0);
+}
+
+static void bench_once(int n) {
+    init_sem(&bench_start, 0);
+    init_rc(&bench_ready);
+    for (int i = 0; i < n; i++) {
+        auto p = create_proc();
+        set_parent_to_this(p);
+        start_proc(p, bench_worker, BENCH_ROUNDS);
+    }
+    while (bench_ready.count < n)
+        yield();
+
+    u64 t0 = get_timestamp();
+    for (int i = 0; i < n; i++)
+        post_sem(&bench_start);
+    for (int i = 0; i < n; i++) {
+        int code;
+        ASSERT(wait(&code) != -1);
+    }
+    u64 ticks = get_timestamp() - t0;
+
+    u64 ns = ticks * 1000 / (get_clock_frequency() / 1000000);
+    printk("sched_bench: %d procs, %lld switches, %lld ns/switch\n",
+           n, (u64)n * BENCH_ROUNDS, ns / ((u64)n * BENCH_ROUNDS));
+}
+
+void sched_bench() {
+    static const int nprocs[] = {4, 16, 64, 256, 1000};
+    printk("sched_bench\n");
+    for (usize i = 0; i < sizeof(nprocs) / sizeof(nprocs[0]); i++)
+        bench_once(nprocs[i]);
+    struct schedstat st;
+    get_schedstat(&st);
+    printk("sched_bench: %lld wakeups, latency avg %lld ns max %lld ns, %lld ipis\n",
+           st.nr_wakeups, st.avg_wakeup_latency_ns, st.max_wakeup_latency_ns, st.nr_ipis);
+    printk("sched_bench PASS\n");
+}
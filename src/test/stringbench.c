@@ -0,0 +1,91 @@
+#include <aarch64/intrinsic.h>
+#include <common/string.h>
+#include <kernel/mem.h>
+#include <kernel/printk.h>
+#include <test/test.h>
+
+// throughput of the mem* functions for 16 B - 4 KB, in bytes per cpu cycle
+// (from the PMU cycle counter, or per timer tick if there is none)
+
+#define BENCH_ITERS 2000
+#define FAIL(...)                                                              \
+    {                                                                          \
+        printk(__VA_ARGS__);                                                   \
+        while (1)                                                              \
+            ;                                                                  \
+    }
+
+static bool use_pmu;
+
+static void pmu_init() {
+    // enable the counters, reset and enable the cycle counter
+    asm volatile("msr pmcr_el0, %0" ::"r"(1ull | 4ull));
+    asm volatile("msr pmcntenset_el0, %0" ::"r"(1ull << 31));
+    asm volatile("isb");
+}
+
+static u64 cycles() {
+    u64 c;
+    if (!use_pmu)
+        return get_timestamp();
+    asm volatile("isb; mrs %0, pmccntr_el0" : "=r"(c));
+    return c;
+}
+
+enum { OP_MEMCPY, OP_MEMSET, OP_MEMZERO, OP_MEMCMP, OP_MEMMOVE, NOPS };
+static const char* op_names[NOPS] = {"memcpy", "memset", "memset(0)",
+                                     "memcmp", "memmove"};
+
+static u64 run(int op, u8* a, u8* b, usize n) {
+    int r = 0;
+    u64 t0 = cycles();
+    for (int i = 0; i < BENCH_ITERS; i++) {
+        switch (op) {
+            case OP_MEMCPY: memcpy(a, b, n); break;
+            case OP_MEMSET: memset(a, 0x5a, n); break;
+            case OP_MEMZERO: memset(a, 0, n); break;
+            case OP_MEMCMP: r |= memcmp(a, b, n); break;
+            // overlapping, copies backwards
+            case OP_MEMMOVE: memmove(a + 8, a, n); break;
+        }
+    }
+    u64 t = cycles() - t0;
+    if (op == OP_MEMCMP && r)
+        FAIL("FAIL: memcmp of equal buffers\n");
+    return MAX(t, 1ull);
+}
+
+void string_bench() {
+    u8* a = kalloc_pages(1);
+    u8* b = kalloc_pages(1);
+    printk("string_bench\n");
+    pmu_init();
+    // without a PMU, e.g. under qemu, the cycle counter does not advance
+    use_pmu = true;
+    u64 c0 = cycles();
+    for (volatile int i = 0; i < 100; i++)
+        ;
+    use_pmu = cycles() != c0;
+    for (int i = 0; i < 2 * PAGE_SIZE; i++)
+        b[i] = (u8)(i * 7);
+    memcpy(a, b, 2 * PAGE_SIZE);
+    if (memcmp(a, b, 2 * PAGE_SIZE))
+        FAIL("FAIL: memcpy\n");
+    memset(a + 3, 0, PAGE_SIZE);
+    for (int i = 0; i < 2 * PAGE_SIZE; i++)
+        if (a[i] != ((i >= 3 && i < PAGE_SIZE + 3) ? 0 : b[i]))
+            FAIL("FAIL: memset at %d\n", i);
+    printk("bytes per %s x100:\n", use_pmu ? "cycle" : "timer tick");
+    for (int op = 0; op < NOPS; op++) {
+        printk("%s:", op_names[op]);
+        for (usize n = 16; n <= PAGE_SIZE; n *= 2) {
+            memcpy(a, b, n);
+            u64 t = run(op, a, b, n);
+            printk(" %lluB %llu", (u64)n, (u64)n * BENCH_ITERS * 100 / t);
+        }
+        printk("\n");
+    }
+    kfree_pages(a);
+    kfree_pages(b);
+    printk("string_bench PASS\n");
+}
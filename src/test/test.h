@@ -5,8 +5,14 @@
 void pgfault_first_test();
 void pgfault_second_test();
 void alloc_test();
+void alloc_bench();
+void buddy_test();
+void kmem_cache_test();
+void string_bench();
+void huge_bench();
 void rbtree_test();
 void proc_test();
+void sched_bench();
 void ipc_test();
 void vm_test();
 void user_proc_test();
@@ -0,0 +1,86 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// see kernel/syscallno.h and kernel/tlb.h
+#define SYS_sbrk 12
+#define SYS_tlbstat 508
+
+#define PGSIZE 4096
+#define ROUNDS 10
+
+struct tlbstat {
+    uint64_t timestamp;
+    uint64_t freq;
+    uint64_t full;
+    uint64_t asid;
+    uint64_t page;
+    uint64_t rollovers;
+    uint64_t switches;
+};
+
+static struct tlbstat now() {
+    struct tlbstat st;
+    syscall(SYS_tlbstat, &st);
+    return st;
+}
+
+static uint64_t us(struct tlbstat* a, struct tlbstat* b) {
+    return (b->timestamp - a->timestamp) * 1000000 / a->freq;
+}
+
+// fork a process with `size` bytes of heap, and let the child exit at once
+static void bench(const char* mode, uint64_t size) {
+    uint64_t fork_us = 0, exit_us = 0;
+    struct tlbstat st0 = now();
+    for (int i = 0; i < ROUNDS; i++) {
+        struct tlbstat t0 = now();
+        int pid = fork();
+        if (pid == 0)
+            exit(0);
+        if (pid < 0) {
+            printf("forkbench: fork failed\n");
+            exit(1);
+        }
+        struct tlbstat t1 = now();
+        wait(NULL);
+        struct tlbstat t2 = now();
+        fork_us += us(&t0, &t1);
+        exit_us += us(&t1, &t2);
+    }
+    struct tlbstat st = now();
+    printf("%s %lluMB: fork %llu us, exit %llu us, flushes %llu page %llu asid\n",
+           mode, (unsigned long long)(size >> 20),
+           (unsigned long long)(fork_us / ROUNDS),
+           (unsigned long long)(exit_us / ROUNDS),
+           (unsigned long long)(st.page - st0.page),
+           (unsigned long long)(st.asid - st0.asid));
+}
+
+// usage: forkbench [MB], by default for a heap of 1 to 64 MB
+int main(int argc, char* argv[]) {
+    uint64_t max = (argc > 1 ? atoi(argv[1]) : 64) << 20;
+    uint64_t size = argc > 1 ? max : 1 << 20;
+
+    // grown a page at a time, the heap is mapped by pages
+    char* heap = (char*)syscall(SYS_sbrk, 0);
+    uint64_t off = 0;
+    for (; size <= max; size *= 4) {
+        for (; off < size; off += PGSIZE) {
+            syscall(SYS_sbrk, PGSIZE);
+            heap[off] = 1;
+        }
+        bench("pages", size);
+    }
+    syscall(SYS_sbrk, -(long)off);
+
+    // grown at once, by 2 MB blocks where they fit
+    heap = (char*)syscall(SYS_sbrk, max);
+    for (off = 0; off < max; off += PGSIZE)
+        heap[off] = 1;
+    bench("blocks", max);
+    syscall(SYS_sbrk, -(long)max);
+    return 0;
+}
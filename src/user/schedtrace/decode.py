@@ -0,0 +1,117 @@
+#!/usr/bin/env python3
+"""
+Turn the output of `schedtrace dump` into per-process run/wait timelines.
+
+Usage: decode.py [--timeline] <console log>
+
+Lines not starting with "ev " are ignored, so a whole captured console log
+can be passed in. Each process is in one of three states between events:
+running, runnable (waiting for a cpu) or sleeping.
+"""
+
+import sys
+from collections import defaultdict
+
+EV_SWITCH, EV_WAKEUP, EV_MIGRATE, EV_LEVEL = 1, 2, 3, 4
+# enum procstate in kernel/proc.h
+STATES = ["UNUSED", "RUNNABLE", "RUNNING", "SLEEPING", "DEEPSLEEPING", "ZOMBIE"]
+
+
+def parse(path):
+    events = []
+    with open(path, errors="replace") as f:
+        for line in f:
+            fields = line.split()
+            if len(fields) != 7 or fields[0] != "ev":
+                continue
+            cpu, ts, typ, pid, a0, a1 = map(int, fields[1:])
+            events.append((ts, cpu, typ, pid, a0, a1))
+    events.sort()
+    return events
+
+
+class Proc:
+    def __init__(self, pid):
+        self.pid = pid
+        self.state = None
+        self.since = None
+        self.cpu = None
+        self.total = defaultdict(int)
+        self.max_wait = 0
+        self.segments = []
+        self.migrations = 0
+        self.levels = []
+
+    def enter(self, state, ts, cpu):
+        if self.state is not None:
+            d = ts - self.since
+            self.total[self.state] += d
+            if self.state == "runnable":
+                self.max_wait = max(self.max_wait, d)
+            self.segments.append((self.since, ts, self.state, self.cpu))
+        self.state, self.since, self.cpu = state, ts, cpu
+
+
+def decode(events):
+    procs = {}
+
+    def get(pid):
+        if pid not in procs:
+            procs[pid] = Proc(pid)
+        return procs[pid]
+
+    for ts, cpu, typ, pid, a0, a1 in events:
+        if typ == EV_SWITCH:
+            if pid >= 0:
+                state = STATES[a1] if 0 <= a1 < len(STATES) else str(a1)
+                get(pid).enter("runnable" if state == "RUNNABLE" else
+                               "sleeping" if state.endswith("SLEEPING") else
+                               state.lower(), ts, cpu)
+            if a0 >= 0:
+                get(a0).enter("running", ts, cpu)
+        elif typ == EV_WAKEUP:
+            get(pid).enter("runnable", ts, a1)
+        elif typ == EV_MIGRATE:
+            p = get(pid)
+            p.migrations += 1
+            p.cpu = a1
+        elif typ == EV_LEVEL:
+            get(pid).levels.append((ts, a0, a1))
+    return procs
+
+
+def ms(ns):
+    return "%.3f" % (ns / 1e6)
+
+
+def main(argv):
+    timeline = "--timeline" in argv
+    paths = [a for a in argv[1:] if not a.startswith("--")]
+    if len(paths) != 1:
+        print(__doc__.strip())
+        return 1
+    events = parse(paths[0])
+    if not events:
+        print("no events")
+        return 1
+    procs = decode(events)
+    span = events[-1][0] - events[0][0]
+    print("%d events over %s ms" % (len(events), ms(span)))
+    print("%6s %10s %10s %10s %10s %5s %5s" %
+          ("pid", "run(ms)", "wait(ms)", "sleep(ms)", "maxwait", "migr", "lvl"))
+    for pid in sorted(procs):
+        p = procs[pid]
+        print("%6d %10s %10s %10s %10s %5d %5d" %
+              (pid, ms(p.total["running"]), ms(p.total["runnable"]),
+               ms(p.total["sleeping"]), ms(p.max_wait), p.migrations,
+               len(p.levels)))
+        if timeline:
+            for begin, end, state, cpu in p.segments:
+                print("       %12s %12s  %-9s cpu %s" %
+                      (ms(begin - events[0][0]), ms(end - events[0][0]),
+                       state, cpu))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
@@ -0,0 +1,54 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+// see kernel/schedtrace.h
+#define SYS_schedtrace 503
+#define SCHED_TRACE_STOP 0
+#define SCHED_TRACE_START 1
+#define SCHED_TRACE_READ 2
+
+struct sched_event {
+    uint64_t ts;
+    uint32_t type;
+    uint32_t cpu;
+    int32_t pid;
+    int32_t _pad;
+    int64_t a0, a1;
+};
+
+static struct sched_event buf[128];
+
+static void usage() {
+    printf("usage: schedtrace start|stop|dump\n");
+}
+
+// print the drained events, decode.py turns a console log into timelines
+static int dump() {
+    long n;
+    while ((n = syscall(SYS_schedtrace, SCHED_TRACE_READ, buf, 128)) > 0) {
+        for (long i = 0; i < n; i++) {
+            struct sched_event* ev = &buf[i];
+            printf("ev %u %llu %u %d %lld %lld\n", ev->cpu,
+                   (unsigned long long)ev->ts, ev->type, ev->pid,
+                   (long long)ev->a0, (long long)ev->a1);
+        }
+    }
+    return n < 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc != 2) {
+        usage();
+        return 1;
+    }
+    if (!strcmp(argv[1], "start"))
+        return syscall(SYS_schedtrace, SCHED_TRACE_START, 0, 0) != 0;
+    if (!strcmp(argv[1], "stop"))
+        return syscall(SYS_schedtrace, SCHED_TRACE_STOP, 0, 0) != 0;
+    if (!strcmp(argv[1], "dump"))
+        return dump();
+    usage();
+    return 1;
+}
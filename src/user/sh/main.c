@@ -16,6 +16,9 @@
 
 #define MAXARGS 10
 
+// see kernel/syscallno.h and kernel/proc.h
+#define SYS_spawn 509
+
 struct cmd {
     int type;
 };
@@ -53,6 +56,7 @@ struct backcmd {
 };
 
 int fork1(void);  // Fork but panics on failure.
+int spawncmd(char *);
 
 struct cmd *parsecmd(char *);
 
@@ -188,10 +192,47 @@ int main(int argc, char *argv[]) {
                 fprintf(stderr, "cannot cd %s\n", buf + 3);
             continue;
         }
-        if (fork1() == 0)
+        // a command without redirection, pipes or lists is started
+        // without copying the shell
+        int pid = spawncmd(buf);
+        if (pid < 0 && fork1() == 0)
             runcmd(parsecmd(buf));
-        wait(NULL);
+        if (pid != 0)
+            wait(NULL);
+    }
+}
+
+extern char **environ;
+extern char whitespace[];
+extern char symbols[];
+
+// Spawn a simple command and return its pid, 0 if nothing was started or -1
+// if it is not a simple command.
+int spawncmd(char *buf) {
+    char *argv[MAXARGS + 1];
+    int argc = 0;
+    if (strpbrk(buf, symbols))
+        return -1;
+    for (char *s = buf; *s;) {
+        while (*s && strchr(whitespace, *s))
+            *s++ = 0;
+        if (!*s)
+            break;
+        if (argc == MAXARGS)
+            PANIC("too many args");
+        argv[argc++] = s;
+        while (*s && !strchr(whitespace, *s))
+            s++;
     }
+    if (argc == 0)
+        return 0;
+    argv[argc] = 0;
+    long pid = syscall(SYS_spawn, argv[0], argv, environ, NULL, 0);
+    if (pid < 0) {
+        fprintf(stderr, "exec %s failed\n", argv[0]);
+        return 0;
+    }
+    return pid;
 }
 
 int fork1(void) {
@@ -0,0 +1,100 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// see kernel/syscallno.h, kernel/proc.h and kernel/tlb.h
+#define SYS_sbrk 12
+#define SYS_tlbstat 508
+#define SYS_spawn 509
+
+#define PGSIZE 4096
+#define ROUNDS 10
+
+struct tlbstat {
+    uint64_t timestamp;
+    uint64_t freq;
+    uint64_t full;
+    uint64_t asid;
+    uint64_t page;
+    uint64_t rollovers;
+    uint64_t switches;
+};
+
+extern char** environ;
+static char* self;
+
+static struct tlbstat now() {
+    struct tlbstat st;
+    syscall(SYS_tlbstat, &st);
+    return st;
+}
+
+static uint64_t us(struct tlbstat* a, struct tlbstat* b) {
+    return (b->timestamp - a->timestamp) * 1000000 / a->freq;
+}
+
+static int start(int mode) {
+    char* argv[] = {self, "-c", NULL};
+    int pid;
+    switch (mode) {
+        case 0:
+            pid = fork();
+            break;
+        case 1:
+            pid = vfork();
+            break;
+        default:
+            return syscall(SYS_spawn, self, argv, environ, NULL, 0);
+    }
+    if (pid == 0) {
+        execve(self, argv, environ);
+        _exit(1);
+    }
+    return pid;
+}
+
+// start the program itself, which exits at once, and wait for it
+static void bench(uint64_t size) {
+    static const char* modes[] = {"fork+exec", "vfork+exec", "spawn"};
+    printf("%lluKB heap:", (unsigned long long)(size >> 10));
+    for (int mode = 0; mode < 3; mode++) {
+        uint64_t t = 0;
+        for (int i = 0; i < ROUNDS; i++) {
+            struct tlbstat t0 = now();
+            int pid = start(mode);
+            if (pid < 0) {
+                printf("\nspawnbench: %s failed\n", modes[mode]);
+                exit(1);
+            }
+            wait(NULL);
+            struct tlbstat t1 = now();
+            t += us(&t0, &t1);
+        }
+        printf(" %s %llu us", modes[mode], (unsigned long long)(t / ROUNDS));
+    }
+    printf("\n");
+}
+
+// usage: spawnbench [KB], by default without a heap and with 4 MB of it
+int main(int argc, char* argv[]) {
+    if (argc > 1 && strcmp(argv[1], "-c") == 0)
+        return 0;
+    self = argv[0];
+    uint64_t size = (argc > 1 ? atoi(argv[1]) : 4096) << 10;
+    if (argc == 1)
+        bench(0);
+
+    // grown a page at a time, the heap is mapped by pages
+    char* heap = (char*)syscall(SYS_sbrk, 0);
+    for (uint64_t off = 0; off < size; off += PGSIZE) {
+        syscall(SYS_sbrk, PGSIZE);
+        heap[off] = 1;
+    }
+    bench(size);
+    syscall(SYS_sbrk, -(long)size);
+    return 0;
+}
@@ -0,0 +1,56 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// see kernel/tlb.h
+#define SYS_tlbstat 508
+#define SYS_yield 458
+
+struct tlbstat {
+    uint64_t timestamp;
+    uint64_t freq;
+    uint64_t full;
+    uint64_t asid;
+    uint64_t page;
+    uint64_t rollovers;
+    uint64_t switches;
+};
+
+static void rate(const char* name, uint64_t n, uint64_t ticks, uint64_t freq) {
+    printf("%s: %llu, %llu/s\n", name, (unsigned long long)n,
+           (unsigned long long)(n * freq / ticks));
+}
+
+// TLB flushes while a command runs, or over one second
+int main(int argc, char* argv[]) {
+    struct tlbstat st0, st;
+    if (syscall(SYS_tlbstat, &st0) < 0)
+        return 1;
+    if (argc > 1) {
+        int pid = fork();
+        if (pid == 0) {
+            execv(argv[1], argv + 1);
+            printf("tlbstat: cannot run %s\n", argv[1]);
+            return 1;
+        }
+        if (pid < 0)
+            return 1;
+        wait(NULL);
+        syscall(SYS_tlbstat, &st);
+    } else {
+        do {
+            syscall(SYS_yield);
+            syscall(SYS_tlbstat, &st);
+        } while (st.timestamp - st0.timestamp < st0.freq);
+    }
+    uint64_t ticks = st.timestamp - st0.timestamp;
+    if (ticks == 0)
+        ticks = 1;
+    rate("full", st.full - st0.full, ticks, st.freq);
+    rate("asid", st.asid - st0.asid, ticks, st.freq);
+    rate("page", st.page - st0.page, ticks, st.freq);
+    rate("rollovers", st.rollovers - st0.rollovers, ticks, st.freq);
+    rate("switches", st.switches - st0.switches, ticks, st.freq);
+    return 0;
+}